@@ -0,0 +1,511 @@
+#include <iostream>
+#include <SDL.h>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include "constants.h"
+#include "geometry.h"
+#include "scene.h"
+#include "renderer.h"
+#include "threadpool.h"
+#include "distancefield.h"
+#include "wallindex.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// Micro-benchmarks for the inner kernels, run in isolation without a window
+// or event loop. Each case is warmed up, then repeated until it has run for
+// at least the minimum time, and reported as ns per operation and throughput.
+
+// Keeps the optimizer from discarding benchmark results
+static volatile float sink;
+
+struct BenchOptions
+{
+    double warmupSeconds = 0.05;
+    double minSeconds = 0.25;
+    int cpu = 0; // core to pin to, -1 leaves scheduling alone
+    std::string filter;
+};
+
+// Pins the benchmark to one core, remembering the cores it was launched
+// with so multi-threaded cases can be run across all of them. Threads
+// inherit the affinity of the thread that starts them, so a pool created
+// while pinned would run every worker on the one core.
+class CpuAffinity
+{
+private:
+#ifdef __linux__
+    cpu_set_t launch;
+#endif
+    bool saved;
+    int pinned; // -1 when not pinned
+
+public:
+    CpuAffinity() : saved(false), pinned(-1)
+    {
+#ifdef __linux__
+        saved = sched_getaffinity(0, sizeof(launch), &launch) == 0;
+#endif
+    }
+
+    // Cores the process may run on as launched
+    int launchCpuCount() const
+    {
+#ifdef __linux__
+        if (saved)
+            return CPU_COUNT(&launch);
+#endif
+        return static_cast<int>(std::thread::hardware_concurrency());
+    }
+
+    int getPinned() const { return pinned; }
+
+    bool pin(int cpu)
+    {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+            return false;
+        pinned = cpu;
+        return true;
+#else
+        (void)cpu;
+        return false;
+#endif
+    }
+
+    // Return to the launch cores; pin again to undo
+    bool release()
+    {
+#ifdef __linux__
+        if (pinned < 0)
+            return true;
+        if (!saved || sched_setaffinity(0, sizeof(launch), &launch) != 0)
+            return false;
+        pinned = -1;
+        return true;
+#else
+        return pinned < 0;
+#endif
+    }
+};
+
+class Benchmark
+{
+private:
+    BenchOptions options;
+
+public:
+    Benchmark(const BenchOptions &options) : options(options) {}
+
+    bool enabled(const std::string &kernel) const
+    {
+        return options.filter.empty() || kernel.find(options.filter) != std::string::npos;
+    }
+
+    // Run fn (which performs opsPerCall operations) and print its cost
+    template <typename Fn>
+    void run(const char *kernel, const std::string &params, double opsPerCall, const char *unit, Fn fn)
+    {
+        typedef std::chrono::steady_clock Clock;
+
+        Clock::time_point warmupEnd = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                                         std::chrono::duration<double>(options.warmupSeconds));
+        do
+        {
+            fn();
+        } while (Clock::now() < warmupEnd);
+
+        long calls = 0;
+        double elapsed = 0.0;
+        long batch = 1;
+        Clock::time_point start = Clock::now();
+        while (elapsed < options.minSeconds)
+        {
+            for (long i = 0; i < batch; ++i)
+                fn();
+            calls += batch;
+            batch *= 2;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        }
+
+        double ops = calls * opsPerCall;
+        std::printf("%-16s %-34s %12.3f ns/op %12.2f M%s/s\n", kernel, params.c_str(),
+                    elapsed * 1e9 / ops, ops / elapsed * 1e-6, unit);
+        std::fflush(stdout);
+    }
+};
+
+// Random walls of a given orientation inside the default world
+static std::vector<Segment> makeWalls(size_t count, const std::string &orientation, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> x(0.0f, WORLD_WIDTH), y(0.0f, WORLD_HEIGHT), length(5.0f, 60.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 2.0f * PI);
+    std::vector<Segment> walls;
+    walls.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        float x1 = x(rng), y1 = y(rng), l = length(rng);
+        float a = orientation == "horizontal" ? 0.0f
+                  : orientation == "vertical" ? PI * 0.5f
+                  : orientation == "diagonal" ? PI * 0.25f
+                  : orientation == "parallel" ? 0.0f // along the rays cast by the orientation sweep
+                                              : angle(rng);
+        walls.push_back(Segment(x1, y1, x1 + l * std::cos(a), y1 + l * std::sin(a)));
+    }
+    return walls;
+}
+
+// Closest hit over all walls for a fan of rays, as RayCaster does
+static void benchCast(Benchmark &bench, bool quick, std::mt19937 &rng)
+{
+    if (!bench.enabled("cast"))
+        return;
+
+    const Point origin = {WORLD_WIDTH * 0.5f, WORLD_HEIGHT * 0.5f};
+    auto castAll = [&origin](const std::vector<Segment> &walls, const std::vector<Ray> &rays)
+    {
+        float total = 0.0f;
+        for (const Ray &ray : rays)
+        {
+            float closest = std::numeric_limits<float>::infinity();
+            for (const Segment &wall : walls)
+            {
+                Point hit = ray.cast(wall);
+                closest = std::min(closest, std::hypot(hit.x - origin.x, hit.y - origin.y));
+            }
+            total += closest;
+        }
+        sink = total;
+    };
+    auto castCloserAll = [](const std::vector<Segment> &walls, const std::vector<Ray> &rays)
+    {
+        float total = 0.0f;
+        for (const Ray &ray : rays)
+        {
+            float closestNum = std::numeric_limits<float>::infinity(), closestDen = 1.0f;
+            for (const Segment &wall : walls)
+                ray.castCloser(wall, closestNum, closestDen);
+            total += closestNum / closestDen;
+        }
+        sink = total;
+    };
+    auto closestHitAll = [](const std::vector<const Segment *> &walls, const std::vector<Ray> &rays)
+    {
+        float total = 0.0f;
+        for (const Ray &ray : rays)
+            total += ray.closestHit(walls, std::numeric_limits<float>::infinity()).distance;
+        sink = total;
+    };
+    // Walls sorted nearest first, each ray seeded with the previous ray's wall
+    auto closestHitSeededAll = [](const std::vector<const Segment *> &walls, const std::vector<float> &minDistances,
+                                  const std::vector<Ray> &rays)
+    {
+        float total = 0.0f;
+        size_t tests = 0;
+        int previous = -1;
+        for (const Ray &ray : rays)
+        {
+            Hit hit = ray.closestHit(walls, minDistances, std::numeric_limits<float>::infinity(), previous, -1, tests);
+            previous = hit.segment;
+            total += hit.distance;
+        }
+        sink = total;
+    };
+
+    std::vector<Ray> fan;
+    for (int i = 0; i < 64; ++i)
+        fan.push_back(Ray(origin.x, origin.y, i * 2.0f * PI / 64));
+
+    const size_t maxWalls = quick ? 100000 : 1000000;
+    for (size_t count = 10; count <= maxWalls; count *= 10)
+    {
+        std::vector<Segment> walls = makeWalls(count, "random", rng);
+        bench.run("Ray::cast", "walls=" + std::to_string(count), static_cast<double>(count) * fan.size(), "test",
+                  [&]() { castAll(walls, fan); });
+        bench.run("Ray::castCloser", "walls=" + std::to_string(count), static_cast<double>(count) * fan.size(), "test",
+                  [&]() { castCloserAll(walls, fan); });
+
+        std::vector<const Segment *> wallList;
+        for (const Segment &wall : walls)
+            wallList.push_back(&wall);
+        bench.run("Ray::closestHit", "walls=" + std::to_string(count), static_cast<double>(count) * fan.size(), "test",
+                  [&]() { closestHitAll(wallList, fan); });
+
+        // Reported per test a full query would make, so it compares with the rows above
+        std::vector<std::pair<float, const Segment *>> nearest;
+        for (const Segment &wall : walls)
+            nearest.push_back({std::sqrt(segmentDistanceSquared(origin, wall.x1, wall.y1, wall.x2, wall.y2)), &wall});
+        std::sort(nearest.begin(), nearest.end());
+        std::vector<const Segment *> sortedWalls;
+        std::vector<float> minDistances;
+        for (const auto &wall : nearest)
+        {
+            sortedWalls.push_back(wall.second);
+            minDistances.push_back(wall.first);
+        }
+        bench.run("Ray::closestHit", "walls=" + std::to_string(count) + " seeded", static_cast<double>(count) * fan.size(),
+                  "test", [&]() { closestHitSeededAll(sortedWalls, minDistances, fan); });
+    }
+
+    // Orientation changes the branch mix: misses, parallel rejects, hits
+    std::vector<Ray> horizontal;
+    for (int i = 0; i < 64; ++i)
+        horizontal.push_back(Ray(origin.x, i * WORLD_HEIGHT / 64, i % 2 ? 0.0f : PI));
+    for (const char *orientation : {"horizontal", "vertical", "diagonal", "random", "parallel"})
+    {
+        std::vector<Segment> walls = makeWalls(10000, orientation, rng);
+        const std::vector<Ray> &rays = std::string(orientation) == "parallel" ? horizontal : fan;
+        bench.run("Ray::cast", std::string("walls=10000 ") + orientation, 10000.0 * rays.size(), "test",
+                  [&]() { castAll(walls, rays); });
+        bench.run("Ray::castCloser", std::string("walls=10000 ") + orientation, 10000.0 * rays.size(), "test",
+                  [&]() { castCloserAll(walls, rays); });
+    }
+}
+
+// Distance field marching for a fan of rays as the wall count grows, per ray
+static void benchMarch(Benchmark &bench, bool quick, std::mt19937 &rng)
+{
+    if (!bench.enabled("march"))
+        return;
+
+    ThreadPool pool(1);
+    std::vector<Ray> fan;
+    for (int i = 0; i < 64; ++i)
+        fan.push_back(Ray(WORLD_WIDTH * 0.5f, WORLD_HEIGHT * 0.5f, i * 2.0f * PI / 64));
+
+    const size_t maxWalls = quick ? 100000 : 1000000;
+    for (size_t count = 10; count <= maxWalls; count *= 10)
+    {
+        Scene scene;
+        scene.setWalls(makeWalls(count, "random", rng));
+        for (float cell : {2.0f, 8.0f})
+        {
+            DistanceField field;
+            field.build(scene, cell, pool);
+            bench.run("DistanceField::march", "walls=" + std::to_string(count) + " cell=" + std::to_string(static_cast<int>(cell)),
+                      static_cast<double>(fan.size()), "ray", [&]()
+            {
+                float total = 0.0f;
+                size_t steps = 0, tests = 0;
+                for (const Ray &ray : fan)
+                    total += field.march(ray, std::numeric_limits<float>::infinity(), steps, tests).distance;
+                sink = total;
+            });
+        }
+    }
+}
+
+// Load-time build of the grid and LBVH wall index, per wall, on one worker
+// and on every core the benchmark was launched with. The multi-threaded
+// cases are unpinned for their run, or skipped when that fails, so their
+// workers are not all on the pinned core.
+static void benchIndex(Benchmark &bench, bool quick, std::mt19937 &rng, CpuAffinity &affinity)
+{
+    if (!bench.enabled("index"))
+        return;
+
+    std::vector<int> threadCounts = {1};
+    const int cores = affinity.launchCpuCount();
+    if (cores > 1)
+        threadCounts.push_back(cores);
+    const size_t maxWalls = quick ? 100000 : 1000000;
+    for (size_t count = 1000; count <= maxWalls; count *= 10)
+    {
+        Scene scene;
+        scene.setWalls(makeWalls(count, "random", rng));
+        for (int threads : threadCounts)
+        {
+            const int pinned = affinity.getPinned();
+            if (threads > 1 && !affinity.release())
+            {
+                std::cerr << "Could not unpin from CPU " << pinned << ", skipping WallIndex::build threads="
+                          << threads << std::endl;
+                continue;
+            }
+            {
+                ThreadPool pool(threads);
+                WallIndex index;
+                bench.run("WallIndex::build", "walls=" + std::to_string(count) + " threads=" + std::to_string(threads),
+                          static_cast<double>(count), "wall", [&]()
+                {
+                    index.build(scene, pool);
+                    sink = static_cast<float>(index.getGrid().getListedCount());
+                });
+            }
+            if (pinned >= 0 && affinity.getPinned() < 0 && !affinity.pin(pinned))
+                std::cerr << "Could not pin to CPU " << pinned << " again, timings may be noisy" << std::endl;
+        }
+    }
+}
+
+// Attenuated ray fills of increasing length on a large target
+static void benchDrawRay(Benchmark &bench)
+{
+    if (!bench.enabled("drawRay"))
+        return;
+
+    const int size = 4096;
+    Renderer renderer(nullptr, size, size);
+    renderer.beginFrame();
+    const float scale = 10.0f; // push the falloff cutoff past the longest ray
+    PixelBounds drawn;
+    for (int length : {16, 128, 1024, 2048})
+    {
+        int angleIndex = 0;
+        bench.run("drawRay", "length=" + std::to_string(length) + " target=4096^2", length, "px",
+                  [&]()
+                  {
+                      float angle = (angleIndex++ % 360) * PI / 180.0f;
+                      renderer.drawRay(size * 0.5f, size * 0.5f, angle, static_cast<float>(length - 1), scale, drawn);
+                  });
+    }
+    renderer.endFrame();
+}
+
+// Bresenham, clipped span and anti-aliased lines by length and slope
+static void benchDrawLine(Benchmark &bench)
+{
+    if (!bench.enabled("drawLine"))
+        return;
+
+    Renderer renderer(nullptr, 3840, 2160);
+    renderer.beginFrame();
+    struct Slope
+    {
+        const char *name;
+        float dx, dy;
+    };
+    for (int length : {16, 256, 2048})
+    {
+        for (Slope slope : {Slope{"horizontal", 1.0f, 0.0f}, Slope{"vertical", 0.0f, 1.0f},
+                            Slope{"diagonal", 0.7071f, 0.7071f}, Slope{"shallow", 0.9701f, 0.2425f}})
+        {
+            int x2 = 100 + static_cast<int>(slope.dx * length), y2 = 50 + static_cast<int>(slope.dy * length);
+            double pixels = std::max(std::abs(x2 - 100), std::abs(y2 - 50)) + 1;
+            bench.run("drawLine", "length=" + std::to_string(length) + " " + slope.name, pixels, "px",
+                      [&]() { renderer.drawLine(100, 50, x2, y2, 0xFFFFFFFF); });
+            bench.run("drawSpanLine", "length=" + std::to_string(length) + " " + slope.name, pixels, "px",
+                      [&]() { renderer.drawSpanLine(100.0f, 50.0f, static_cast<float>(x2), static_cast<float>(y2), 0xFFFFFFFF); });
+            bench.run("drawSmoothLine", "length=" + std::to_string(length) + " " + slope.name, pixels, "px",
+                      [&]() { renderer.drawSmoothLine(100.0f, 50.0f, static_cast<float>(x2), static_cast<float>(y2), 0xFFFFFFFF); });
+        }
+    }
+    renderer.endFrame();
+}
+
+// Compositing the anti-aliased wall layer over a lit frame: a read-modify-write
+// of every covered pixel, at a row width that is and one that is not a whole
+// number of cache lines
+static void benchBlend(Benchmark &bench)
+{
+    if (!bench.enabled("drawWalls"))
+        return;
+
+    struct Size
+    {
+        int width, height;
+    };
+    Scene scene;
+    scene.generateRooms(12, 12);
+    for (Size size : {Size{1366, 768}, Size{1920, 1080}})
+    {
+        Renderer renderer(nullptr, size.width, size.height);
+        Transform transform = {std::min(size.width, size.height) / (12 * ROOM_SIZE), 0.0f, 0.0f};
+        for (bool antialias : {false, true})
+        {
+            // Half-transparent light under the walls, so covered pixels blend
+            renderer.beginFrame();
+            for (int y = 0; y < size.height; ++y)
+                std::fill_n(renderer.getPixels() + static_cast<size_t>(y) * renderer.getPixelPerRow(), size.width,
+                            0x80FFFF66);
+            renderer.drawWalls(scene, transform, antialias); // builds the layer outside the timing
+            bench.run("drawWalls", std::to_string(size.width) + "x" + std::to_string(size.height) +
+                                       (antialias ? " smooth" : " solid"),
+                      static_cast<double>(renderer.getWallLayerPixels()), "px",
+                      [&]() { renderer.drawWalls(scene, transform, antialias); });
+            renderer.endFrame();
+        }
+    }
+}
+
+// Full-screen clears across output resolutions
+static void benchClear(Benchmark &bench)
+{
+    if (!bench.enabled("clearTexture"))
+        return;
+
+    struct Size
+    {
+        int width, height;
+    };
+    for (Size size : {Size{800, 600}, Size{1920, 1080}, Size{3840, 2160}, Size{7680, 4320}})
+    {
+        Renderer renderer(nullptr, size.width, size.height);
+        renderer.beginFrame();
+        bench.run("clearTexture", std::to_string(size.width) + "x" + std::to_string(size.height),
+                  static_cast<double>(size.width) * size.height, "px", [&]() { renderer.clearTexture(); });
+        renderer.endFrame();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+    bool quick = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--quick")
+        {
+            quick = true;
+            options.warmupSeconds = 0.01;
+            options.minSeconds = 0.05;
+        }
+        else if (arg == "--cpu" && hasValue)
+        {
+            options.cpu = std::atoi(argv[++i]);
+        }
+        else if (arg == "--min-time" && hasValue)
+        {
+            options.minSeconds = std::atof(argv[++i]);
+        }
+        else if (arg == "--filter" && hasValue)
+        {
+            options.filter = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--quick] [--cpu N|-1] [--min-time S] [--filter KERNEL]" << std::endl;
+            return -1;
+        }
+    }
+
+    CpuAffinity affinity;
+    if (options.cpu >= 0 && !affinity.pin(options.cpu))
+        std::cerr << "Could not pin to CPU " << options.cpu << ", timings may be noisy" << std::endl;
+
+    Benchmark bench(options);
+    std::mt19937 rng(42);
+    benchCast(bench, quick, rng);
+    benchMarch(bench, quick, rng);
+    benchIndex(bench, quick, rng, affinity);
+    benchDrawRay(bench);
+    benchDrawLine(bench);
+    benchBlend(bench);
+    benchClear(bench);
+
+    return 0;
+}
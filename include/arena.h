@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include "constants.h"
+
+// Bump allocator for data that only lives until the next reset. Allocation
+// is a pointer bump; nothing is freed individually. When a frame overflows
+// the current block a new one is chained, and the next reset coalesces them
+// into a single block so steady-state frames make no heap calls at all.
+class Arena
+{
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> memory;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t offset;   // into the last block
+    size_t used;     // bytes handed out since the last reset
+    size_t peak;     // largest `used` seen
+    size_t capacity; // total bytes across blocks
+
+    void addBlock(size_t minimum)
+    {
+        size_t size = std::max<size_t>(minimum, blocks.empty() ? ARENA_MIN_BLOCK : blocks.back().size * 2);
+        blocks.push_back({std::unique_ptr<char[]>(new char[size]), size});
+        offset = 0;
+        capacity += size;
+    }
+
+public:
+    Arena() : offset(0), used(0), peak(0), capacity(0) {}
+
+    Arena(Arena &&) = default;
+    Arena &operator=(Arena &&) = default;
+
+    void *allocate(size_t bytes, size_t alignment)
+    {
+        if (blocks.empty())
+            addBlock(bytes + alignment);
+
+        uintptr_t base = reinterpret_cast<uintptr_t>(blocks.back().memory.get());
+        size_t start = ((base + offset + alignment - 1) & ~(alignment - 1)) - base;
+        if (start + bytes > blocks.back().size)
+        {
+            addBlock(bytes + alignment);
+            base = reinterpret_cast<uintptr_t>(blocks.back().memory.get());
+            start = ((base + alignment - 1) & ~(alignment - 1)) - base;
+        }
+
+        offset = start + bytes;
+        used += bytes;
+        peak = std::max(peak, used);
+        return blocks.back().memory.get() + start;
+    }
+
+    // Invalidate everything allocated since the last reset
+    void reset()
+    {
+        if (blocks.size() > 1)
+        {
+            size_t total = capacity;
+            blocks.clear();
+            capacity = 0;
+            addBlock(total);
+        }
+        offset = 0;
+        used = 0;
+    }
+
+    size_t getUsed() const { return used; }
+    size_t getPeak() const { return peak; }
+    size_t getCapacity() const { return capacity; }
+};
+
+// Standard allocator drawing from an Arena; deallocation is a no-op
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    Arena *arena;
+
+    explicit ArenaAllocator(Arena &arena) : arena(&arena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t count)
+    {
+        return static_cast<T *>(arena->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+};
+
+// Vector whose storage lives in a frame arena; never keep one across a reset
+template <typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+// Per-frame transient memory owned by the Application: one arena for the
+// render thread and a sub-arena per worker thread so workers never contend.
+// Everything is reset at the start of each frame.
+class FrameArena
+{
+private:
+    Arena mainArena;
+    std::vector<Arena> workerArenas;
+    size_t peak; // most bytes used by a finished frame, over all arenas together
+
+public:
+    explicit FrameArena(int workerCount) : workerArenas(std::max(workerCount, 1)), peak(0) {}
+
+    Arena &get() { return mainArena; }
+
+    Arena &worker(int index) { return workerArenas[index]; }
+
+    int getWorkerCount() const { return static_cast<int>(workerArenas.size()); }
+
+    void reset()
+    {
+        peak = std::max(peak, getUsed());
+        mainArena.reset();
+        for (Arena &arena : workerArenas)
+            arena.reset();
+    }
+
+    // Bytes used so far this frame, render thread plus all workers
+    size_t getUsed() const
+    {
+        size_t used = mainArena.getUsed();
+        for (const Arena &arena : workerArenas)
+            used += arena.getUsed();
+        return used;
+    }
+
+    // Peak bytes used in a single frame, render thread plus all workers
+    size_t getPeak() const
+    {
+        return std::max(peak, getUsed());
+    }
+
+    size_t getCapacity() const
+    {
+        size_t capacity = mainArena.getCapacity();
+        for (const Arena &arena : workerArenas)
+            capacity += arena.getCapacity();
+        return capacity;
+    }
+};
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <iostream>
+#include <SDL.h>
+#include <SDL_image.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Frames are drawn with per-pixel alpha over a black background; flatten
+// them to the displayed colour
+inline void flattenToRGB(const Uint32 *pixels, int pixelPerRow, int width, int height, std::vector<Uint8> &rgb)
+{
+    rgb.resize(static_cast<size_t>(width) * height * 3);
+    Uint8 *out = rgb.data();
+    for (int y = 0; y < height; ++y)
+    {
+        const Uint32 *row = pixels + static_cast<size_t>(y) * pixelPerRow;
+        for (int x = 0; x < width; ++x)
+        {
+            Uint32 alpha = row[x] >> 24;
+            *out++ = static_cast<Uint8>(((row[x] >> 16) & 0xFF) * alpha / 255);
+            *out++ = static_cast<Uint8>(((row[x] >> 8) & 0xFF) * alpha / 255);
+            *out++ = static_cast<Uint8>((row[x] & 0xFF) * alpha / 255);
+        }
+    }
+}
+
+inline bool writePPM(const char *path, const std::vector<Uint8> &rgb, int width, int height)
+{
+    FILE *file = std::fopen(path, "wb");
+    if (!file)
+        return false;
+    std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+    bool ok = std::fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+// Reads a binary P6 PPM with 8-bit channels
+inline bool readPPM(const char *path, std::vector<Uint8> &rgb, int &width, int &height)
+{
+    FILE *file = std::fopen(path, "rb");
+    if (!file)
+        return false;
+    int maxValue = 0;
+    bool ok = std::fscanf(file, "P6 %d %d %d", &width, &height, &maxValue) == 3 && maxValue == 255 &&
+              width > 0 && height > 0 && std::fgetc(file) != EOF;
+    if (ok)
+    {
+        rgb.resize(static_cast<size_t>(width) * height * 3);
+        ok = std::fread(rgb.data(), 1, rgb.size(), file) == rgb.size();
+    }
+    std::fclose(file);
+    return ok;
+}
+
+// Records frames to disk. The render thread only copies the framebuffer
+// into a preallocated pool slot; a writer thread converts and writes it.
+class FrameCapture
+{
+public:
+    enum Format
+    {
+        FORMAT_PPM, // one P6 file per frame
+        FORMAT_PNG, // one PNG per frame through SDL_image
+        FORMAT_RAW  // all frames appended to one rgb24 file
+    };
+
+    enum Policy
+    {
+        POLICY_DROP, // skip frames while the pool is exhausted
+        POLICY_BLOCK // wait for the writer to free a slot
+    };
+
+private:
+    struct Frame
+    {
+        std::vector<Uint32> pixels;
+        int width, height;
+        int number;
+    };
+
+    std::string pathPattern;
+    Format format;
+    Policy policy;
+    std::vector<Frame> pool;
+    std::vector<int> freeSlots;
+    std::deque<int> pending;
+    int frameNumber;
+    int writtenCount;
+    int droppedCount;
+    int failedCount; // frames not written, from the first failure on
+    bool failed;     // stops capture; later frames are counted as failed
+    FILE *rawFile;
+    int rawWidth, rawHeight; // the size of every frame in a raw stream
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable frameReady;
+    std::condition_variable slotFreed;
+    bool stopping;
+
+    bool writeFrame(const Frame &frame, std::vector<Uint8> &rgb)
+    {
+        flattenToRGB(frame.pixels.data(), frame.width, frame.width, frame.height, rgb);
+
+        if (format == FORMAT_RAW)
+            return std::fwrite(rgb.data(), 1, rgb.size(), rawFile) == rgb.size();
+
+        char path[1024];
+        std::snprintf(path, sizeof(path), pathPattern.c_str(), frame.number);
+
+        if (format == FORMAT_PNG)
+        {
+            SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(
+                rgb.data(), frame.width, frame.height, 24, frame.width * 3, SDL_PIXELFORMAT_RGB24);
+            if (!surface)
+                return false;
+            bool ok = IMG_SavePNG(surface, path) == 0;
+            SDL_FreeSurface(surface);
+            return ok;
+        }
+
+        return writePPM(path, rgb, frame.width, frame.height);
+    }
+
+    void writeLoop()
+    {
+        std::vector<Uint8> rgb;
+        while (true)
+        {
+            int slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                frameReady.wait(lock, [this]() { return stopping || !pending.empty(); });
+                if (pending.empty())
+                    return; // stopping with everything flushed
+                slot = pending.front();
+                pending.pop_front();
+            }
+
+            bool skip;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                skip = failed;
+            }
+            bool ok = !skip && writeFrame(pool[slot], rgb);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (ok)
+                    ++writtenCount;
+                else
+                    ++failedCount;
+                if (!ok && !failed)
+                    std::cerr << "Frame capture failed writing frame " << pool[slot].number << ", stopping" << std::endl;
+                failed = failed || !ok;
+                freeSlots.push_back(slot);
+            }
+            slotFreed.notify_one();
+        }
+    }
+
+public:
+    FrameCapture(const std::string &pathPattern, Policy policy, int poolSize)
+        : pathPattern(pathPattern), policy(policy), pool(std::max(poolSize, 1)), frameNumber(0),
+          writtenCount(0), droppedCount(0), failedCount(0), failed(false), rawFile(nullptr), rawWidth(0), rawHeight(0),
+          stopping(false)
+    {
+        std::string extension = pathPattern.substr(pathPattern.find_last_of('.') + 1);
+        format = extension == "png" ? FORMAT_PNG : (extension == "rgb" || extension == "raw") ? FORMAT_RAW : FORMAT_PPM;
+        for (int slot = 0; slot < static_cast<int>(pool.size()); ++slot)
+            freeSlots.push_back(slot);
+    }
+
+    ~FrameCapture()
+    {
+        stop();
+        if (rawFile)
+        {
+            std::fclose(rawFile);
+        }
+    }
+
+    // Write every queued frame and end the writer
+    void stop()
+    {
+        if (writer.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            frameReady.notify_all();
+            writer.join();
+        }
+    }
+
+    // Preallocate the pool for the given frame size and start the writer
+    bool start(int width, int height)
+    {
+        if (format == FORMAT_RAW)
+        {
+            rawFile = std::fopen(pathPattern.c_str(), "wb");
+            if (!rawFile)
+            {
+                std::cerr << "Could not open capture file " << pathPattern << std::endl;
+                return false;
+            }
+            rawWidth = width;
+            rawHeight = height;
+        }
+        for (Frame &frame : pool)
+        {
+            frame.pixels.resize(static_cast<size_t>(width) * height);
+            frame.width = width;
+            frame.height = height;
+        }
+        writer = std::thread(&FrameCapture::writeLoop, this);
+        return true;
+    }
+
+    // Copy a framebuffer into a free slot and queue it for writing. A raw
+    // stream has no header to mark a new size, so it stops at a resize.
+    void submit(const Uint32 *pixels, int pixelPerRow, int width, int height)
+    {
+        int slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!failed && format == FORMAT_RAW && (width != rawWidth || height != rawHeight))
+            {
+                std::cerr << "Frame capture stopped: " << pathPattern << " holds " << rawWidth << "x" << rawHeight
+                          << " frames, not " << width << "x" << height << std::endl;
+                failed = true;
+            }
+            if (failed)
+            {
+                ++failedCount;
+                ++frameNumber;
+                return;
+            }
+            if (freeSlots.empty())
+            {
+                if (policy == POLICY_DROP)
+                {
+                    ++droppedCount;
+                    ++frameNumber;
+                    return;
+                }
+                slotFreed.wait(lock, [this]() { return !freeSlots.empty(); });
+            }
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+
+        Frame &frame = pool[slot];
+        frame.pixels.resize(static_cast<size_t>(width) * height); // only reallocates after a resize
+        frame.width = width;
+        frame.height = height;
+        frame.number = frameNumber++;
+        for (int y = 0; y < height; ++y)
+        {
+            std::memcpy(&frame.pixels[static_cast<size_t>(y) * width],
+                        pixels + static_cast<size_t>(y) * pixelPerRow, width * sizeof(Uint32));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(slot);
+        }
+        frameReady.notify_one();
+    }
+
+    int getWrittenCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return writtenCount;
+    }
+
+    int getDroppedCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return droppedCount;
+    }
+
+    int getFailedCount()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return failedCount;
+    }
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+// Constants
+#define DEFAULT_SCREEN_WIDTH 800
+#define DEFAULT_SCREEN_HEIGHT 600
+#define WORLD_WIDTH 800.0f  // world extent shown at zoom 1
+#define WORLD_HEIGHT 600.0f
+#define ROOM_SIZE 200.0f    // side of a generated room
+#define DOOR_WIDTH 60.0f
+#define MIN_ZOOM 0.01f
+#define MAX_ZOOM 100.0f
+#define PAN_SPEED 600.0f // screen pixels per second
+#define WORLD_FILE_MAGIC "RCWORLD1"
+#define WORLD_FILE_VERSION 1u
+#define DEFAULT_TILE_SIZE 1000.0f
+#define DEFAULT_STREAM_BUDGET_MB 64
+#define PREFETCH_SECONDS 0.5f // how far ahead along the origin's velocity to prefetch
+#define DEFAULT_CAPTURE_POOL 8
+#define FRAME_ROW_ALIGNMENT 64 // bytes; framebuffer rows start on a cache line
+#define ARENA_MIN_BLOCK (64 * 1024) // first block of a frame arena, in bytes
+#define MAX_VISIBILITY_LIGHTS 32     // one bit per light in the lit mask
+#define RAYS_PER_TASK 1024           // rays traced per parallel task of a light's sweep
+#define LIGHT_TILE_SIZE 32           // screen tile edge for tiled many-light shading, in pixels
+#define LIGHT_REACH_SECTORS 256      // angular sectors summarising how far each light sees, for tile binning
+#define DEFAULT_LIGHT_SAMPLES 8      // area light sample origins per frame
+#define ACCUMULATION_MAX_FRAMES 32   // temporal history length before it turns into a moving average
+#define CONFIG_POLL_SECONDS 0.5f     // how often the config file is checked for changes
+#define GRID_MAX_CELLS (1 << 24)     // wall grid cells before the cell size is doubled
+#define GRID_CELL_PAD 1e-3f          // fraction of a cell a wall is widened by when binned
+#define WALLS_PER_GRID_CELL 2.0f     // average walls per cell the wall index grid is sized for
+#define SORT_BLOCK_KEYS (1 << 16)    // keys per parallel task of the index builds
+#define INDEX_CACHE_MAGIC "RCINDEX1"
+#define INDEX_CACHE_VERSION 1u
+#define INDEX_CACHE_SUFFIX ".index"  // appended to a scene file's path for its index cache
+#define INDEX_CACHE_ALIGNMENT 64     // bytes; cache sections start on a cache line
+#define FIELD_FAR 1e30f              // squared distance of cells with no wall in reach
+#define GOLDEN_RATIO_FRACTION 0.61803398875f
+#define DEFAULT_GOLDEN_TOLERANCE 2       // per-channel difference ignored by the golden check
+#define DEFAULT_GOLDEN_MAX_BAD_PIXELS 16 // pixels per case allowed beyond the tolerance
+#define DEFAULT_GOLDEN_MAX_DIFF 16       // channel difference that fails a case on any pixel
+#define PI 3.14159265358979f
+#define ANGLE_STEP_DEG 0.05f
+#define FALLOFF_K 0.005f
+#define MIN_ALPHA (1.0f / 255.0f)   // attenuation below which a ray pixel rounds to alpha 0
+#define PARALLEL_EPSILON 1e-6f      // |sin| of the ray/wall angle below which they count as parallel
+#define ENDPOINT_EPSILON 1e-5f      // fraction of its length a wall is extended by at each end for ray hits
+#define DISTANCE_BOUND_SLACK 1e-4f  // relative margin keeping rounded wall distance bounds conservative
+#define PORTAL_ANGLE_MARGIN 1e-4f   // radians added on each side of a portal window
+#define PORTAL_EPSILON 1e-3f        // world distance at which the origin counts as standing in a portal
+#define PIXEL_CLIP_EPSILON 1e-3f    // keeps clipped line ends inside the last pixel
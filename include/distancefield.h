@@ -0,0 +1,242 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "constants.h"
+#include "geometry.h"
+#include "scene.h"
+#include "threadpool.h"
+#include "wallindex.h"
+
+// Distance field over the scene's walls, for marching rays at a cost that
+// does not grow with the wall count. The scene is covered by a WallGrid,
+// and each cell stores its clearance, a lower bound on the distance from any
+// point of the cell to the nearest wall, from an exact Euclidean distance
+// transform of the occupied cells.
+// Walls are open segments with no inside, so the field is unsigned.
+//
+// A marched ray steps ahead by the clearance of the cell it is in. Cells
+// next to walls have none; those are walked one at a time, testing the ray
+// against the walls listed in each, so the hit found is the exact one.
+class DistanceField
+{
+private:
+    // Work space for the distance transform of one row or column
+    struct LineScratch
+    {
+        std::vector<double> values;
+        std::vector<int> parabolas; // positions of the parabolas in the lower envelope
+        std::vector<double> starts; // where each envelope parabola takes over
+    };
+
+    const Scene *scene;
+    unsigned int sceneVersion;
+    float requestedCell;
+    WallGrid grid;
+    std::vector<float> clearance; // per grid cell, in world units
+
+    // Exact 1D squared distance transform (Felzenszwalb and Huttenlocher) of
+    // count values spaced stride apart, in place. Values of FIELD_FAR or more
+    // mark cells with nothing in them and add no parabola, so a line without
+    // any finite value is left as it is.
+    static void transformLine(float *line, int stride, int count, LineScratch &scratch)
+    {
+        scratch.values.resize(count);
+        scratch.parabolas.resize(count);
+        scratch.starts.resize(count + 1);
+        for (int i = 0; i < count; ++i)
+            scratch.values[i] = line[static_cast<size_t>(i) * stride];
+
+        const std::vector<double> &f = scratch.values;
+        int top = -1;
+        for (int q = 0; q < count; ++q)
+        {
+            if (f[q] >= FIELD_FAR)
+                continue;
+            double start = -std::numeric_limits<double>::infinity();
+            while (top >= 0)
+            {
+                const int p = scratch.parabolas[top];
+                start = ((f[q] + static_cast<double>(q) * q) - (f[p] + static_cast<double>(p) * p)) / (2.0 * (q - p));
+                if (start > scratch.starts[top])
+                    break;
+                --top;
+                start = -std::numeric_limits<double>::infinity();
+            }
+            ++top;
+            scratch.parabolas[top] = q;
+            scratch.starts[top] = start;
+        }
+        if (top < 0)
+            return;
+
+        scratch.starts[top + 1] = std::numeric_limits<double>::infinity();
+        int envelope = 0;
+        for (int q = 0; q < count; ++q)
+        {
+            while (scratch.starts[envelope + 1] < q)
+                ++envelope;
+            const int p = scratch.parabolas[envelope];
+            line[static_cast<size_t>(q) * stride] = static_cast<float>(static_cast<double>(q - p) * (q - p) + f[p]);
+        }
+    }
+
+public:
+    DistanceField()
+        : scene(nullptr), sceneVersion(0), requestedCell(0.0f) {}
+
+    // Whether the field was built from this version of the scene with this cell size
+    bool isBuiltFor(const Scene &target, float cell) const
+    {
+        return scene == &target && sceneVersion == target.getVersion() && requestedCell == cell;
+    }
+
+    // Bin the scene's walls into cells of about cell world units, doubled
+    // until the grid fits in GRID_MAX_CELLS, and compute the clearances.
+    // The scene must outlive the field; a changed scene needs a rebuild.
+    void build(const Scene &target, float cell, ThreadPool &pool)
+    {
+        scene = &target;
+        sceneVersion = target.getVersion();
+        requestedCell = cell;
+
+        const std::vector<Segment> &walls = target.getWalls();
+        grid.build(walls, walls.empty() ? Rect{0.0f, 0.0f, 0.0f, 0.0f} : target.bounds(), cell, pool);
+        const int columns = grid.getColumns(), rows = grid.getRows();
+        const size_t cellCount = grid.getCellCount();
+
+        // Squared distance in cells to the nearest occupied cell, transforming rows then columns
+        clearance.resize(cellCount);
+        for (size_t c = 0; c < cellCount; ++c)
+            clearance[c] = grid.isOccupied(static_cast<int>(c)) ? 0.0f : FIELD_FAR;
+        std::vector<LineScratch> scratch(pool.getWorkerCount());
+        pool.parallelFor(rows, [&](int row, int worker)
+        {
+            transformLine(&clearance[static_cast<size_t>(row) * columns], 1, columns, scratch[worker]);
+        });
+        pool.parallelFor(columns, [&](int column, int worker)
+        {
+            transformLine(&clearance[column], columns, rows, scratch[worker]);
+        });
+
+        // Both a point of the cell and the nearest wall point may be half a
+        // diagonal from their cell centres, so take a whole diagonal off
+        const float diagonal = std::sqrt(2.0f);
+        for (float &value : clearance)
+        {
+            float distance = value >= FIELD_FAR ? std::numeric_limits<float>::infinity() : std::sqrt(value);
+            value = std::max(distance - diagonal, 0.0f) * grid.getCellSize() * (1.0f - DISTANCE_BOUND_SLACK);
+        }
+    }
+
+    unsigned int getSceneVersion() const { return sceneVersion; }
+    const WallGrid &getGrid() const { return grid; }
+
+    // Whether p lies on a wall, as Scene::isPointOnSegment decides it
+    bool isOnWall(Point p) const
+    {
+        const float x = static_cast<float>(static_cast<int>(p.x)), y = static_cast<float>(static_cast<int>(p.y));
+        const Point corner = grid.getCorner();
+        const float cellSize = grid.getCellSize();
+        if (clearance.empty() || x < corner.x || y < corner.y || x >= corner.x + grid.getColumns() * cellSize ||
+            y >= corner.y + grid.getRows() * cellSize)
+            return false;
+
+        const int cell = grid.rowOf(y) * grid.getColumns() + grid.columnOf(x);
+        for (const int *wall = grid.cellBegin(cell); wall != grid.cellEnd(cell); ++wall)
+        {
+            if (scene->isPointOnSegment(p.x, p.y, scene->getWalls()[*wall]))
+                return true;
+        }
+        return false;
+    }
+
+    // Closest hit along the ray within maxDistance, its segment being the
+    // Scene::getWalls() index of the wall hit. Adds the cells visited to
+    // `steps` and the ray/wall tests made to `tests`.
+    Hit march(const Ray &ray, float maxDistance, size_t &steps, size_t &tests) const
+    {
+        const Hit miss = {maxDistance, -1, {0.0f, 0.0f}, {0.0f, 0.0f}};
+        if (clearance.empty())
+            return miss;
+
+        // Clip the ray to the grid; nothing lies outside it
+        const Point corner = grid.getCorner();
+        const float cellSize = grid.getCellSize();
+        const int columns = grid.getColumns(), rows = grid.getRows();
+        float t = 0.0f, end = maxDistance;
+        const float lows[2] = {corner.x, corner.y};
+        const float highs[2] = {corner.x + columns * cellSize, corner.y + rows * cellSize};
+        const float positions[2] = {ray.pos.x, ray.pos.y}, directions[2] = {ray.dir.x, ray.dir.y};
+        for (int axis = 0; axis < 2; ++axis)
+        {
+            if (directions[axis] == 0.0f)
+            {
+                if (positions[axis] < lows[axis] || positions[axis] > highs[axis])
+                    return miss;
+                continue;
+            }
+            float toLow = (lows[axis] - positions[axis]) / directions[axis];
+            float toHigh = (highs[axis] - positions[axis]) / directions[axis];
+            t = std::max(t, std::min(toLow, toHigh));
+            end = std::min(end, std::max(toLow, toHigh));
+        }
+        if (t >= end)
+            return miss;
+
+        const std::vector<Segment> &walls = scene->getWalls();
+        const int stepX = ray.dir.x < 0.0f ? -1 : 1, stepY = ray.dir.y < 0.0f ? -1 : 1;
+        int column = grid.columnOf(ray.pos.x + ray.dir.x * t), row = grid.rowOf(ray.pos.y + ray.dir.y * t);
+        while (true)
+        {
+            ++steps;
+            const int cell = row * columns + column;
+            if (clearance[cell] > 0.0f)
+            {
+                t += clearance[cell];
+                if (t >= end)
+                    return miss;
+                column = grid.columnOf(ray.pos.x + ray.dir.x * t);
+                row = grid.rowOf(ray.pos.y + ray.dir.y * t);
+                continue;
+            }
+
+            // Next to a wall: a hit on one of this cell's walls before the
+            // ray leaves the cell is the closest, as nothing came before it
+            const float exitX = ray.dir.x == 0.0f ? std::numeric_limits<float>::infinity()
+                                                  : (corner.x + (column + (stepX > 0)) * cellSize - ray.pos.x) / ray.dir.x;
+            const float exitY = ray.dir.y == 0.0f ? std::numeric_limits<float>::infinity()
+                                                  : (corner.y + (row + (stepY > 0)) * cellSize - ray.pos.y) / ray.dir.y;
+            const float exit = std::min(exitX, exitY);
+            float bestNum = maxDistance, bestDen = 1.0f;
+            int best = -1;
+            for (const int *wall = grid.cellBegin(cell); wall != grid.cellEnd(cell); ++wall)
+            {
+                ++tests;
+                if (ray.castCloser(walls[*wall], bestNum, bestDen))
+                    best = *wall;
+            }
+            if (best >= 0 && bestNum <= exit * bestDen)
+            {
+                // Rebuild the winner's hit exactly, with its point and normal
+                const std::array<const Segment *, 1> winner = {&walls[best]};
+                Hit hit = ray.closestHit(winner, maxDistance);
+                hit.segment = best;
+                return hit;
+            }
+
+            if (exit >= end)
+                return miss;
+            t = std::max(t, exit);
+            if (exitX < exitY)
+                column += stepX;
+            else
+                row += stepY;
+            if (column < 0 || column >= columns || row < 0 || row >= rows)
+                return miss;
+        }
+    }
+};
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "constants.h"
+
+// World distance at which exp(-k * d) falls below the smallest visible alpha
+inline float lightCutoffRadius(float k = FALLOFF_K)
+{
+    return std::log(1.0f / MIN_ALPHA) / k;
+}
+
+// Point structure to represent positions
+struct Point
+{
+    float x, y;
+};
+
+// Axis-aligned rectangle
+struct Rect
+{
+    float minX, minY, maxX, maxY;
+
+    bool intersects(const Rect &other) const
+    {
+        return minX <= other.maxX && other.minX <= maxX && minY <= other.maxY && other.minY <= maxY;
+    }
+
+    Rect intersection(const Rect &other) const
+    {
+        return {std::max(minX, other.minX), std::max(minY, other.minY),
+                std::min(maxX, other.maxX), std::min(maxY, other.maxY)};
+    }
+
+    bool contains(Point p) const
+    {
+        return p.x >= minX && p.x <= maxX && p.y >= minY && p.y <= maxY;
+    }
+
+    // Liang-Barsky clip of the segment to this rectangle; false if it lies outside
+    bool clipSegment(float &x1, float &y1, float &x2, float &y2) const
+    {
+        float dx = x2 - x1, dy = y2 - y1;
+        float t0 = 0.0f, t1 = 1.0f;
+        const float p[4] = {-dx, dx, -dy, dy};
+        const float q[4] = {x1 - minX, maxX - x1, y1 - minY, maxY - y1};
+        for (int i = 0; i < 4; ++i)
+        {
+            if (p[i] == 0.0f)
+            {
+                if (q[i] < 0.0f)
+                    return false;
+                continue;
+            }
+            float r = q[i] / p[i];
+            if (p[i] < 0.0f)
+                t0 = std::max(t0, r);
+            else
+                t1 = std::min(t1, r);
+            if (t0 > t1)
+                return false;
+        }
+        float startX = x1, startY = y1;
+        x1 = startX + t0 * dx;
+        y1 = startY + t0 * dy;
+        x2 = startX + t1 * dx;
+        y2 = startY + t1 * dy;
+        return true;
+    }
+};
+
+// Uniform world-to-screen transform
+struct Transform
+{
+    float scale;
+    float offsetX, offsetY;
+
+    Point toScreen(Point p) const
+    {
+        return {p.x * scale + offsetX, p.y * scale + offsetY};
+    }
+
+    Point toWorld(Point p) const
+    {
+        return {(p.x - offsetX) / scale, (p.y - offsetY) / scale};
+    }
+
+    // World-space rectangle covered by a screen of the given size
+    Rect visibleWorld(int screenWidth, int screenHeight) const
+    {
+        Point topLeft = toWorld({0.0f, 0.0f});
+        Point bottomRight = toWorld({static_cast<float>(screenWidth), static_cast<float>(screenHeight)});
+        return {topLeft.x, topLeft.y, bottomRight.x, bottomRight.y};
+    }
+};
+
+// Camera looking at a world point; zoom 1 fits WORLD_WIDTH x WORLD_HEIGHT on screen
+class Camera
+{
+public:
+    float centerX, centerY;
+    float zoom;
+
+    Camera() : centerX(WORLD_WIDTH * 0.5f), centerY(WORLD_HEIGHT * 0.5f), zoom(1.0f) {}
+
+    Transform transform(int screenWidth, int screenHeight) const
+    {
+        float scale = std::min(screenWidth / WORLD_WIDTH, screenHeight / WORLD_HEIGHT) * zoom;
+        return {scale, screenWidth * 0.5f - centerX * scale, screenHeight * 0.5f - centerY * scale};
+    }
+
+    // Move the camera by a screen-space offset
+    void pan(float screenDX, float screenDY, const Transform &current)
+    {
+        centerX += screenDX / current.scale;
+        centerY += screenDY / current.scale;
+    }
+
+    // Zoom by a factor while keeping the world point under screenPoint fixed
+    void zoomAt(Point screenPoint, float factor, int screenWidth, int screenHeight)
+    {
+        Point anchor = transform(screenWidth, screenHeight).toWorld(screenPoint);
+        zoom = std::max(MIN_ZOOM, std::min(MAX_ZOOM, zoom * factor));
+        Point moved = transform(screenWidth, screenHeight).toScreen(anchor);
+        pan(moved.x - screenPoint.x, moved.y - screenPoint.y, transform(screenWidth, screenHeight));
+    }
+};
+
+// Segment structure to represent walls
+class Segment
+{
+public:
+    float x1, y1, x2, y2;
+
+    Segment(float x1, float y1, float x2, float y2)
+        : x1(x1), y1(y1), x2(x2), y2(y2) {}
+
+    Rect bounds() const
+    {
+        return {std::min(x1, x2), std::min(y1, y2), std::max(x1, x2), std::max(y1, y2)};
+    }
+};
+
+// Squared distance from p to the closest point of segment (x1, y1)-(x2, y2)
+inline float segmentDistanceSquared(Point p, float x1, float y1, float x2, float y2)
+{
+    float dx = x2 - x1, dy = y2 - y1;
+    float lengthSquared = dx * dx + dy * dy;
+    float t = lengthSquared > 0.0f ? ((p.x - x1) * dx + (p.y - y1) * dy) / lengthSquared : 0.0f;
+    t = std::max(0.0f, std::min(1.0f, t));
+    float cx = x1 + t * dx - p.x, cy = y1 + t * dy - p.y;
+    return cx * cx + cy * cy;
+}
+
+// Arc of directions from start to start + width, counter-clockwise in
+// radians, start in [0, 2*PI). A width of 2*PI or more is every direction.
+struct AngleRange
+{
+    float start, width;
+
+    static float wrap(float angle)
+    {
+        angle = std::fmod(angle, 2.0f * PI);
+        return angle < 0.0f ? angle + 2.0f * PI : angle;
+    }
+
+    static AngleRange full() { return {0.0f, 2.0f * PI}; }
+
+    // Directions from origin through segment a-b, widened by margin on both sides
+    static AngleRange subtended(Point origin, Point a, Point b, float margin)
+    {
+        float angleA = std::atan2(a.y - origin.y, a.x - origin.x);
+        float angleB = std::atan2(b.y - origin.y, b.x - origin.x);
+        float width = wrap(angleB - angleA);
+        if (width > PI)
+        {
+            std::swap(angleA, angleB);
+            width = 2.0f * PI - width;
+        }
+        return {wrap(angleA - margin), width + 2.0f * margin};
+    }
+
+    bool empty() const { return width <= 0.0f; }
+
+    // Overlap of two ranges; ranges narrower than PI overlap in one piece
+    AngleRange intersection(const AngleRange &other) const
+    {
+        if (width >= 2.0f * PI)
+            return other;
+        if (other.width >= 2.0f * PI)
+            return *this;
+        float offset = wrap(other.start - start);
+        if (offset < width)
+            return {other.start, std::min(other.width, width - offset)};
+        offset = wrap(start - other.start);
+        if (offset < other.width)
+            return {start, std::min(width, other.width - offset)};
+        return {start, 0.0f};
+    }
+};
+
+// Closest wall hit by a ray
+struct Hit
+{
+    float distance; // along the ray; the search limit when nothing was hit
+    int segment;    // index into the searched wall list, -1 when nothing was hit
+    Point point;
+    Point normal;   // unit wall normal facing the ray origin
+
+    bool isHit() const { return segment >= 0; }
+};
+
+// Ray class to handle ray operations
+class Ray
+{
+public:
+    Point pos; // Starting point of the ray
+    Point dir; // Normalized direction vector
+
+    // Constructor to initialize ray position and angle
+    Ray(float x, float y, float angle)
+    {
+        pos = {x, y};
+        dir = {std::cos(angle), std::sin(angle)};
+    }
+
+    // Cast ray against a wall and find intersection
+    Point cast(const Segment &wall) const
+    {
+        float x1 = wall.x1, y1 = wall.y1;
+        float x2 = wall.x2, y2 = wall.y2;
+        float x3 = pos.x, y3 = pos.y;
+        float x4 = pos.x + dir.x, y4 = pos.y + dir.y;
+
+        // Calculate determinant
+        float den = (x1 - x2) * (y3 - y4) - (y1 - y2) * (x3 - x4);
+        if (den == 0)
+        {
+            // Parallel or collinear, no intersection
+            return {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity()};
+        }
+
+        // Solve for t and u
+        float t = ((x1 - x3) * (y3 - y4) - (y1 - y3) * (x3 - x4)) / den;
+        float u = -((x1 - x2) * (y1 - y3) - (y1 - y2) * (x1 - x3)) / den;
+
+        // Check if intersection is valid
+        if (t >= 0 && t <= 1 && u >= 0)
+        {
+            // Calculate intersection point
+            float px = x1 + t * (x2 - x1);
+            float py = y1 + t * (y2 - y1);
+            return {px, py};
+        }
+
+        // No valid intersection
+        return {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity()};
+    }
+
+    // Division-free cast for closest-hit searches. The range tests run on the
+    // numerators scaled by sign(den), and a hit replaces the current best
+    // distance, kept as the fraction bestNum / bestDen, only if it is closer.
+    // The caller divides once when the search is done. Since dir is unit
+    // length the fraction is the distance along the ray.
+    bool castCloser(const Segment &wall, float &bestNum, float &bestDen) const
+    {
+        float ex = wall.x2 - wall.x1, ey = wall.y2 - wall.y1;
+        float wx = wall.x1 - pos.x, wy = wall.y1 - pos.y;
+
+        float den = ex * dir.y - ey * dir.x;
+        float sign = den < 0.0f ? -1.0f : 1.0f;
+        float absDen = den * sign;
+        float tNum = (wy * dir.x - wx * dir.y) * sign; // position along the wall, in [0, absDen]
+        float uNum = (ex * wy - ey * wx) * sign;       // distance along the ray, scaled by absDen
+
+        // Evaluated without early exits so the compiler can use selects; the
+        // first test rejects walls parallel to the ray within tolerance. The
+        // wall's ends are widened by ENDPOINT_EPSILON of its length, so a ray
+        // through a corner two walls share cannot round its way past both.
+        const float endSlack = ENDPOINT_EPSILON * absDen;
+        bool closer = (absDen > PARALLEL_EPSILON * (std::fabs(ex) + std::fabs(ey))) &
+                      (tNum >= -endSlack) & (tNum <= absDen + endSlack) & (uNum >= 0.0f) &
+                      (uNum * bestDen < bestNum * absDen);
+        bestNum = closer ? uNum : bestNum;
+        bestDen = closer ? absDen : bestDen;
+        return closer;
+    }
+
+    // Closest hit among walls within maxDistance. The search keeps only the
+    // minimum distance fraction; the point and normal are built for the winner.
+    template <typename WallList>
+    Hit closestHit(const WallList &walls, float maxDistance) const
+    {
+        float bestNum = maxDistance, bestDen = 1.0f;
+        int best = -1;
+        for (size_t i = 0; i < walls.size(); ++i)
+        {
+            if (castCloser(*walls[i], bestNum, bestDen))
+                best = static_cast<int>(i);
+        }
+        return makeHit(walls, best, bestNum, bestDen, maxDistance);
+    }
+
+    // Closest hit among walls sorted nearest first by a lower bound on their
+    // distance from the ray origin (minDistances[i] <= any hit on walls[i]).
+    // The likely winners `seed` and `altSeed` (-1 for none) are tested first
+    // to shorten the search, which then stops at the first wall that cannot
+    // beat the current best. Adds the number of intersection tests made to
+    // `tests`.
+    template <typename WallList, typename DistanceList>
+    Hit closestHit(const WallList &walls, const DistanceList &minDistances, float maxDistance, int seed, int altSeed,
+                   size_t &tests) const
+    {
+        float bestNum = maxDistance, bestDen = 1.0f;
+        int best = -1;
+        altSeed = altSeed == seed ? -1 : altSeed;
+        for (int candidate : {seed, altSeed})
+        {
+            if (candidate < 0)
+                continue;
+            ++tests;
+            if (castCloser(*walls[candidate], bestNum, bestDen))
+                best = candidate;
+        }
+        for (size_t i = 0; i < walls.size(); ++i)
+        {
+            if (minDistances[i] * bestDen >= bestNum)
+                break;
+            if (static_cast<int>(i) == seed || static_cast<int>(i) == altSeed)
+                continue;
+            ++tests;
+            if (castCloser(*walls[i], bestNum, bestDen))
+                best = static_cast<int>(i);
+        }
+        return makeHit(walls, best, bestNum, bestDen, maxDistance);
+    }
+
+private:
+    template <typename WallList>
+    Hit makeHit(const WallList &walls, int best, float bestNum, float bestDen, float maxDistance) const
+    {
+        Hit hit = {maxDistance, best, {0.0f, 0.0f}, {0.0f, 0.0f}};
+        if (best < 0)
+            return hit;
+
+        const Segment &wall = *walls[best];
+        hit.distance = bestNum / bestDen;
+        hit.point = {pos.x + dir.x * hit.distance, pos.y + dir.y * hit.distance};
+        float nx = wall.y1 - wall.y2, ny = wall.x2 - wall.x1;
+        float length = std::sqrt(nx * nx + ny * ny);
+        float facing = nx * dir.x + ny * dir.y > 0.0f ? -1.0f : 1.0f;
+        hit.normal = {nx * facing / length, ny * facing / length};
+        return hit;
+    }
+};
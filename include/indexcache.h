@@ -0,0 +1,261 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <system_error>
+#include "constants.h"
+#include "scene.h"
+#include "wallindex.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define INDEX_CACHE_MMAP 1
+#endif
+
+// On-disk layout of a wall index cache: a header, then the arrays of a
+// WallIndex in IndexCacheSection order, each starting on an
+// INDEX_CACHE_ALIGNMENT boundary so they can be read straight out of a
+// mapping of the file. A cache belongs to the scene file with the FNV-1a
+// hash in its header and is only valid for that file's walls.
+enum IndexCacheSection
+{
+    CACHE_CELL_STARTS, // int per grid cell, plus one
+    CACHE_CELL_WALLS,  // int per wall listed in a cell
+    CACHE_BVH_NODES,   // WallBVH::Node per internal node
+    CACHE_LEAF_BOUNDS, // Rect per leaf
+    CACHE_LEAF_WALLS,  // int per leaf
+    CACHE_SECTION_COUNT
+};
+
+struct IndexCacheSpan
+{
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+struct IndexCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize; // sizeof(IndexCacheHeader), so a layout change reads as another version
+    uint64_t sceneHash;
+    uint64_t wallCount;
+    float cellSize;
+    float cornerX, cornerY;
+    int32_t columns, rows;
+    uint32_t padding;
+    IndexCacheSpan sections[CACHE_SECTION_COUNT];
+};
+
+// Read-only view of a whole file, mapped where there is mmap and read into
+// memory otherwise
+class MappedFile
+{
+private:
+    const char *bytes;
+    size_t length;
+    std::vector<char> buffer; // the contents, when not mapped
+
+public:
+    MappedFile() : bytes(nullptr), length(0) {}
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+#ifdef INDEX_CACHE_MMAP
+        if (bytes && buffer.empty())
+            munmap(const_cast<char *>(bytes), length);
+#endif
+    }
+
+    // False when the file does not exist or cannot be read
+    bool open(const std::string &path)
+    {
+#ifdef INDEX_CACHE_MMAP
+        const int descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0)
+            return false;
+        struct stat info;
+        void *view = MAP_FAILED;
+        if (fstat(descriptor, &info) == 0 && info.st_size > 0)
+            view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        ::close(descriptor);
+        if (view == MAP_FAILED)
+            return false;
+        bytes = static_cast<const char *>(view);
+        length = static_cast<size_t>(info.st_size);
+        return true;
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file || file.tellg() <= 0)
+            return false;
+        buffer.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        if (!file.read(buffer.data(), static_cast<std::streamsize>(buffer.size())))
+            return false;
+        bytes = buffer.data();
+        length = buffer.size();
+        return true;
+#endif
+    }
+
+    const char *data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// Saves the built WallIndex of a scene file next to it, and restores it on
+// later runs while the file is unchanged, in place of the build
+class IndexCache
+{
+private:
+    static uint64_t aligned(uint64_t offset)
+    {
+        return (offset + INDEX_CACHE_ALIGNMENT - 1) / INDEX_CACHE_ALIGNMENT * INDEX_CACHE_ALIGNMENT;
+    }
+
+public:
+    static std::string pathFor(const std::string &scenePath)
+    {
+        return scenePath + INDEX_CACHE_SUFFIX;
+    }
+
+    // Write the index built from the scene file hashing to sceneHash. It goes
+    // to a temporary file renamed over the cache, so no reader sees a part.
+    static bool save(const std::string &path, uint64_t sceneHash, const WallIndex &index)
+    {
+        const WallGrid &grid = index.getGrid();
+        const WallBVH &bvh = index.getBVH();
+        IndexCacheHeader header = {};
+        std::memcpy(header.magic, INDEX_CACHE_MAGIC, sizeof(header.magic));
+        header.version = INDEX_CACHE_VERSION;
+        header.headerSize = sizeof(IndexCacheHeader);
+        header.sceneHash = sceneHash;
+        header.wallCount = bvh.getLeafWalls().size();
+        header.cellSize = grid.getCellSize();
+        header.cornerX = grid.getCorner().x;
+        header.cornerY = grid.getCorner().y;
+        header.columns = grid.getColumns();
+        header.rows = grid.getRows();
+
+        const void *arrays[CACHE_SECTION_COUNT] = {grid.getCellStarts().data(), grid.getCellWalls().data(),
+                                                   bvh.getNodes().data(), bvh.getLeafBounds().data(),
+                                                   bvh.getLeafWalls().data()};
+        header.sections[CACHE_CELL_STARTS].bytes = grid.getCellStarts().size() * sizeof(int);
+        header.sections[CACHE_CELL_WALLS].bytes = grid.getCellWalls().size() * sizeof(int);
+        header.sections[CACHE_BVH_NODES].bytes = bvh.getNodes().size() * sizeof(WallBVH::Node);
+        header.sections[CACHE_LEAF_BOUNDS].bytes = bvh.getLeafBounds().size() * sizeof(Rect);
+        header.sections[CACHE_LEAF_WALLS].bytes = bvh.getLeafWalls().size() * sizeof(int);
+        uint64_t end = sizeof(IndexCacheHeader);
+        for (IndexCacheSpan &section : header.sections)
+        {
+            section.offset = aligned(end);
+            end = section.offset + section.bytes;
+        }
+
+        const std::string temporaryPath = path + ".tmp";
+        FILE *file = std::fopen(temporaryPath.c_str(), "wb");
+        if (!file)
+        {
+            std::cerr << "Could not open " << temporaryPath << " for writing" << std::endl;
+            return false;
+        }
+        static const char zeros[INDEX_CACHE_ALIGNMENT] = {};
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        uint64_t written = sizeof(header);
+        for (int section = 0; section < CACHE_SECTION_COUNT && ok; ++section)
+        {
+            const IndexCacheSpan &span = header.sections[section];
+            const size_t padding = static_cast<size_t>(span.offset - written);
+            ok = std::fwrite(zeros, 1, padding, file) == padding &&
+                 std::fwrite(arrays[section], 1, static_cast<size_t>(span.bytes), file) == span.bytes;
+            written = span.offset + span.bytes;
+        }
+        ok = std::fclose(file) == 0 && ok;
+
+        std::error_code error;
+        if (ok)
+            std::filesystem::rename(temporaryPath, path, error);
+        if (!ok || error)
+        {
+            std::cerr << "Failed writing index cache " << path << std::endl;
+            std::filesystem::remove(temporaryPath, error);
+            return false;
+        }
+        return true;
+    }
+
+    // Restore target's index from the cache at path, written by this version
+    // for the scene file hashing to sceneHash. False, leaving the index as it
+    // was, when there is no cache; a stale or damaged one is also reported.
+    static bool load(const std::string &path, uint64_t sceneHash, const Scene &target, WallIndex &index)
+    {
+        MappedFile file;
+        if (!file.open(path))
+            return false;
+
+        IndexCacheHeader header = {};
+        if (file.size() >= sizeof(header))
+            std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, INDEX_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != INDEX_CACHE_VERSION || header.headerSize != sizeof(IndexCacheHeader))
+        {
+            std::cerr << path << " is not a version " << INDEX_CACHE_VERSION << " index cache, rebuilding" << std::endl;
+            return false;
+        }
+        const size_t wallCount = target.getWalls().size();
+        if (header.sceneHash != sceneHash || header.wallCount != wallCount)
+        {
+            std::cerr << path << " was built from another version of the scene, rebuilding" << std::endl;
+            return false;
+        }
+
+        // Every section must lie within the file, aligned, and hold whole
+        // entries of the count the header implies
+        const uint64_t nodeCount = wallCount > 0 ? wallCount - 1 : 0;
+        const bool gridFits = header.columns > 0 && header.rows > 0 &&
+                              static_cast<double>(header.columns) * header.rows <= GRID_MAX_CELLS;
+        const uint64_t cellCount = gridFits ? static_cast<uint64_t>(header.columns) * header.rows : 0;
+        const IndexCacheSpan *sections = header.sections;
+        bool valid = gridFits && sections[CACHE_CELL_STARTS].bytes == (cellCount + 1) * sizeof(int) &&
+                     sections[CACHE_CELL_WALLS].bytes % sizeof(int) == 0 &&
+                     sections[CACHE_CELL_WALLS].bytes / sizeof(int) <= static_cast<uint64_t>(INT32_MAX) &&
+                     sections[CACHE_BVH_NODES].bytes == nodeCount * sizeof(WallBVH::Node) &&
+                     sections[CACHE_LEAF_BOUNDS].bytes == wallCount * sizeof(Rect) &&
+                     sections[CACHE_LEAF_WALLS].bytes == wallCount * sizeof(int);
+        for (const IndexCacheSpan &section : header.sections)
+        {
+            valid = valid && section.offset % INDEX_CACHE_ALIGNMENT == 0 && section.offset >= sizeof(header) &&
+                    section.bytes <= file.size() && section.offset <= file.size() - section.bytes;
+        }
+
+        WallGrid grid;
+        WallBVH bvh;
+        auto at = [&](IndexCacheSection section) { return file.data() + sections[section].offset; };
+        valid = valid &&
+                grid.restore(header.cellSize, {header.cornerX, header.cornerY}, header.columns, header.rows,
+                             reinterpret_cast<const int *>(at(CACHE_CELL_STARTS)),
+                             reinterpret_cast<const int *>(at(CACHE_CELL_WALLS)),
+                             static_cast<size_t>(sections[CACHE_CELL_WALLS].bytes / sizeof(int)),
+                             static_cast<int>(wallCount)) &&
+                bvh.restore(reinterpret_cast<const WallBVH::Node *>(at(CACHE_BVH_NODES)),
+                            reinterpret_cast<const Rect *>(at(CACHE_LEAF_BOUNDS)),
+                            reinterpret_cast<const int *>(at(CACHE_LEAF_WALLS)), static_cast<int>(wallCount));
+        if (!valid)
+        {
+            std::cerr << path << " is damaged, rebuilding" << std::endl;
+            return false;
+        }
+        index.adopt(target, std::move(grid), std::move(bvh));
+        return true;
+    }
+};
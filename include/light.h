@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cmath>
+#include "constants.h"
+#include "geometry.h"
+
+// Emitter with an extent, lit by averaging several point-light samples
+class AreaLight
+{
+public:
+    enum Shape
+    {
+        SHAPE_POINT,
+        SHAPE_DISC,   // size is the radius
+        SHAPE_SEGMENT // size is the length, centred on the light position
+    };
+
+    Shape shape;
+    float size;  // world units
+    float angle; // segment orientation
+
+    AreaLight() : shape(SHAPE_POINT), size(0.0f), angle(0.0f) {}
+
+    AreaLight(Shape shape, float size, float angle = 0.0f) : shape(shape), size(size), angle(angle) {}
+
+    // Sample origin `index` of `count`. Each sample owns one equal-area
+    // stratum of the emitter and is jittered inside it; the jitter moves
+    // every frame so temporal accumulation keeps finding new positions.
+    Point sample(Point center, int index, int count, unsigned int frame) const
+    {
+        float jitter = frame * GOLDEN_RATIO_FRACTION;
+        jitter -= std::floor(jitter);
+        float u = (index + jitter) / count;
+
+        if (shape == SHAPE_SEGMENT)
+        {
+            float offset = (u - 0.5f) * size;
+            return {center.x + std::cos(angle) * offset, center.y + std::sin(angle) * offset};
+        }
+        if (shape == SHAPE_DISC)
+        {
+            // Equal-area rings, spread around the disc by the golden angle
+            float radius = size * std::sqrt(u);
+            float theta = 2.0f * PI * (index * GOLDEN_RATIO_FRACTION + jitter);
+            return {center.x + std::cos(theta) * radius, center.y + std::sin(theta) * radius};
+        }
+        return center;
+    }
+
+    // How far past the centre any sample can be
+    float extent() const
+    {
+        return shape == SHAPE_DISC ? size : shape == SHAPE_SEGMENT ? size * 0.5f : 0.0f;
+    }
+};
@@ -0,0 +1,505 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "arena.h"
+#include "scene.h"
+#include "renderer.h"
+#include "threadpool.h"
+#include "visibility.h"
+#include "light.h"
+#include "distancefield.h"
+#include "wallindex.h"
+
+// How WallCuller finds the walls that may be near a light
+enum SpatialIndex
+{
+    INDEX_SCAN,    // every wall of the scene
+    INDEX_PORTALS, // the sectors seen through portals, or every wall when there is no sector graph
+    INDEX_GRID,    // the cells of a WallIndex grid meeting the region, or every wall without a current index
+    INDEX_LBVH     // a WallIndex LBVH query of the region, or every wall without a current index
+};
+
+// Per-frame culling stage: keeps only the walls that can shadow a lit,
+// visible pixel, i.e. those crossing both the viewport and the light's disk.
+// Candidates are ordered nearest first so closest-hit searches can stop at
+// the first wall that is farther than their best hit. In scenes with a sector
+// graph only the walls of sectors seen through portals are examined, and with
+// a prebuilt WallIndex only the walls it finds near the region.
+class WallCuller
+{
+private:
+    // A sector reached through a chain of portals, seen through `window`
+    struct PortalVisit
+    {
+        int sector;
+        int from; // sector entered from, -1 for the origin's own
+        AngleRange window;
+        int depth;
+    };
+
+    Arena &arena;
+    FrameVector<const Segment *> candidates; // frame arena storage, nearest first
+    FrameVector<float> minDistances;         // per candidate, a lower bound on its distance from the origin
+    FrameVector<int> candidateOf;            // per scene wall, its candidate index or -1
+    const Segment *wallBase;                 // start of the scene's wall array
+    unsigned int sceneVersion;
+    bool originOnWall;
+    size_t consideredCount;
+
+public:
+    WallCuller(Arena &arena) : arena(arena), candidates(ArenaAllocator<const Segment *>(arena)), minDistances(ArenaAllocator<float>(arena)),
+                               candidateOf(ArenaAllocator<int>(arena)), wallBase(nullptr), sceneVersion(0),
+                               originOnWall(false), consideredCount(0) {}
+
+    // Indices of the walls bounding sectors visible from origin within
+    // radius: the origin's sector, then every sector whose portals line up
+    // with the window of directions seen through the portals before them.
+    // False when the scene has no sectors or the origin is outside them.
+    bool portalWalls(const Scene &scene, Point origin, float radius, FrameVector<int> &walls)
+    {
+        int start = scene.sectorAt(origin);
+        if (start < 0)
+            return false;
+
+        const std::vector<Sector> &sectors = scene.getSectors();
+        const float radiusSquared = radius * radius;
+        FrameVector<char> reachedSector(sectors.size(), 0, ArenaAllocator<char>(arena));
+        FrameVector<char> listed(scene.getWalls().size(), 0, ArenaAllocator<char>(arena));
+        FrameVector<PortalVisit> pending{ArenaAllocator<PortalVisit>(arena)};
+        pending.push_back({start, -1, AngleRange::full(), 0});
+
+        while (!pending.empty())
+        {
+            PortalVisit visit = pending.back();
+            pending.pop_back();
+
+            const Sector &sector = sectors[visit.sector];
+            if (!reachedSector[visit.sector])
+            {
+                reachedSector[visit.sector] = 1;
+                for (int wall : sector.walls)
+                {
+                    if (!listed[wall])
+                        walls.push_back(wall);
+                    listed[wall] = 1;
+                }
+            }
+
+            // A ray never re-enters a convex sector, so no path is longer than the sector count
+            if (visit.depth >= static_cast<int>(sectors.size()))
+                continue;
+
+            for (const Portal &portal : sector.portals)
+            {
+                if (portal.sector == visit.from)
+                    continue;
+                float distanceSquared = segmentDistanceSquared(origin, portal.a.x, portal.a.y, portal.b.x, portal.b.y);
+                if (distanceSquared > radiusSquared)
+                    continue;
+
+                // Standing in the doorway sees all of the next room
+                AngleRange window = distanceSquared < PORTAL_EPSILON * PORTAL_EPSILON
+                                        ? visit.window
+                                        : visit.window.intersection(AngleRange::subtended(origin, portal.a, portal.b, PORTAL_ANGLE_MARGIN));
+                if (!window.empty())
+                    pending.push_back({portal.sector, visit.sector, window, visit.depth + 1});
+            }
+        }
+        return true;
+    }
+
+    // Indices of the walls the grid or LBVH of a WallIndex finds meeting region
+    void indexedWalls(const Scene &scene, const WallIndex &built, SpatialIndex index, const Rect &region,
+                      FrameVector<int> &walls)
+    {
+        if (index == INDEX_LBVH)
+        {
+            built.getBVH().query(region, [&walls](int wall) { walls.push_back(wall); });
+            return;
+        }
+
+        // A wall crossing several cells is listed in each
+        FrameVector<char> listed(scene.getWalls().size(), 0, ArenaAllocator<char>(arena));
+        built.getGrid().query(region, [&](int wall)
+        {
+            if (!listed[wall])
+                walls.push_back(wall);
+            listed[wall] = 1;
+        });
+    }
+
+    // Build this frame's candidate list; it is invalidated by the next arena
+    // reset. Portal traversal assumes a point light and is only valid when
+    // every ray starts at origin. The grid and LBVH indexes need `built` to
+    // be current for the scene.
+    void cull(const Scene &scene, Point origin, float radius, const Rect &viewport, SpatialIndex index = INDEX_PORTALS,
+              const WallIndex *built = nullptr)
+    {
+        FrameVector<const Segment *>(candidates.get_allocator()).swap(candidates);
+        FrameVector<float>(minDistances.get_allocator()).swap(minDistances);
+        FrameVector<int>(scene.getWalls().size(), -1, candidateOf.get_allocator()).swap(candidateOf);
+        originOnWall = false;
+        wallBase = scene.getWalls().data();
+        sceneVersion = scene.getVersion();
+
+        const float radiusSquared = radius * radius;
+        const Rect lightBox = {origin.x - radius, origin.y - radius, origin.x + radius, origin.y + radius};
+        const Rect region = viewport.intersection(lightBox);
+
+        FrameVector<int> visible{ArenaAllocator<int>(arena)};
+        bool listed = index == INDEX_PORTALS && portalWalls(scene, origin, radius, visible);
+        if ((index == INDEX_GRID || index == INDEX_LBVH) && built && built->isBuiltFor(scene))
+        {
+            indexedWalls(scene, *built, index, region, visible);
+            listed = true;
+        }
+        consideredCount = listed ? visible.size() : scene.getWalls().size();
+
+        typedef std::pair<float, const Segment *> Nearest;
+        FrameVector<Nearest> nearest{ArenaAllocator<Nearest>(arena)};
+        for (size_t i = 0; i < consideredCount; ++i)
+        {
+            const Segment &wall = scene.getWalls()[listed ? visible[i] : i];
+            if (!wall.bounds().intersects(region))
+                continue;
+
+            // Only the part of the wall inside the viewport has to reach the disk
+            float x1 = wall.x1, y1 = wall.y1, x2 = wall.x2, y2 = wall.y2;
+            if (!viewport.clipSegment(x1, y1, x2, y2))
+                continue;
+            if (segmentDistanceSquared(origin, x1, y1, x2, y2) > radiusSquared)
+                continue;
+
+            if (scene.isPointOnSegment(origin.x, origin.y, wall))
+                originOnWall = true;
+            float distance = std::sqrt(segmentDistanceSquared(origin, wall.x1, wall.y1, wall.x2, wall.y2));
+            nearest.push_back({distance * (1.0f - DISTANCE_BOUND_SLACK), &wall});
+        }
+
+        std::sort(nearest.begin(), nearest.end());
+        candidates.reserve(nearest.size());
+        minDistances.reserve(nearest.size());
+        for (const Nearest &wall : nearest)
+        {
+            candidateOf[wall.second - wallBase] = static_cast<int>(candidates.size());
+            candidates.push_back(wall.second);
+            minDistances.push_back(wall.first);
+        }
+    }
+
+    const FrameVector<const Segment *> &getCandidates() const { return candidates; }
+
+    const FrameVector<float> &getMinDistances() const { return minDistances; }
+
+    // Scene::getWalls() index of a candidate
+    int sceneIndex(int candidate) const { return static_cast<int>(candidates[candidate] - wallBase); }
+
+    // Candidate index of a Scene::getWalls() index, -1 if it was culled
+    int findCandidate(int sceneIndex) const
+    {
+        return sceneIndex >= 0 && sceneIndex < static_cast<int>(candidateOf.size()) ? candidateOf[sceneIndex] : -1;
+    }
+
+    unsigned int getSceneVersion() const { return sceneVersion; }
+
+    // A light sitting exactly on a wall casts nothing
+    bool isOriginOnWall() const { return originOnWall; }
+
+    size_t getConsideredCount() const { return consideredCount; }
+};
+
+// RayCaster class to handle ray tracing logic
+class RayCaster
+{
+public:
+    // Tracing counters since construction
+    struct TraceStats
+    {
+        size_t frames = 0;
+        size_t reusedFrames = 0;   // frames whose hits were all copied from the previous one
+        size_t rays = 0;
+        size_t seeded = 0;         // rays first tested against last frame's wall in their angle bin
+        size_t seedHits = 0;       // seeded rays that hit the same wall again
+        size_t sweepSeeded = 0;    // rays first tested against the previous ray's wall
+        size_t sweepSeedHits = 0;  // such rays that hit the same wall as the previous ray
+        size_t tests = 0;          // ray/wall intersection tests made
+        size_t candidateTests = 0; // tests a full query of every candidate would have made
+        size_t marchedRays = 0;    // rays marched through the distance field instead
+        size_t marchSteps = 0;     // distance field cells those rays visited
+        size_t marchTests = 0;     // ray/wall intersection tests they made
+    };
+
+private:
+    // The previous frame's hit per angle bin, with the inputs it was traced under
+    struct HitCache
+    {
+        std::vector<VisibilityBuffer::RayRecord> rays;
+        Point origin;
+        Transform transform;
+        int width, height;
+        unsigned int sceneVersion;
+        float falloff;
+        bool valid;
+    };
+
+    // Counters and lit pixels of one chunk of rays, merged once all have run
+    struct RayChunk
+    {
+        TraceStats stats;
+        PixelBounds drawn;
+    };
+
+    Renderer &renderer;
+    ThreadPool &pool;
+    int baseRays; // fewest rays per sweep
+    const DistanceField *distanceField; // marched instead of searching the culled walls, when set
+    HitCache cache;
+    TraceStats stats;
+    std::vector<RayChunk> chunks; // reused across frames
+
+    // Whether last frame's hits are exactly this frame's: same light, view, scene, falloff and ray count
+    bool cacheMatches(Point origin, const Transform &transform, unsigned int sceneVersion, int rayCount) const
+    {
+        return cache.valid && static_cast<int>(cache.rays.size()) == rayCount &&
+               cache.origin.x == origin.x && cache.origin.y == origin.y &&
+               cache.transform.scale == transform.scale && cache.transform.offsetX == transform.offsetX &&
+               cache.transform.offsetY == transform.offsetY && cache.width == renderer.getWidth() &&
+               cache.height == renderer.getHeight() && cache.sceneVersion == sceneVersion &&
+               cache.falloff == renderer.getFalloff();
+    }
+
+public:
+    RayCaster(Renderer &renderer, ThreadPool &pool)
+        : renderer(renderer), pool(pool), baseRays(static_cast<int>(360.0f / ANGLE_STEP_DEG)), distanceField(nullptr),
+          cache({{}, {0.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, 0, 0, 0, 0.0f, false})
+    {
+    }
+
+    const TraceStats &getTraceStats() const { return stats; }
+
+    int getBaseRays() const { return baseRays; }
+    void setBaseRays(int count) { baseRays = std::max(count, 1); }
+
+    // Have traceRays march rays through a distance field built from the
+    // scene, leaving the culler unused, or search the culled walls again
+    // with nullptr. The field must be current for the scene traced.
+    void setDistanceField(const DistanceField *field) { distanceField = field; }
+
+    // Number of rays needed so neighbouring rays stay within a pixel of each
+    // other out to the light cutoff radius, or the screen diagonal if smaller,
+    // and at least the base ray count
+    int rayCount(float scale) const
+    {
+        const float cutoffRadius = std::min(lightCutoffRadius(renderer.getFalloff()) * scale,
+                                            std::hypot(static_cast<float>(renderer.getWidth()),
+                                                       static_cast<float>(renderer.getHeight())));
+        return std::max(baseRays, static_cast<int>(std::ceil(2.0f * PI * cutoffRadius)));
+    }
+
+    // Trace rays in world space from the given world origin against the culled
+    // walls. With a visibility buffer, each ray's hit and the pixels it lights
+    // are recorded in the same pass.
+    //
+    // Hits are cached per angle bin across frames. When nothing changed they
+    // are reused as is. Otherwise each ray first re-tests the wall hit by the
+    // previous ray of this sweep and the wall its bin hit last frame; that
+    // bounds the search, which ends at the first candidate whose nearest
+    // point is farther away.
+    //
+    // Chunks of RAYS_PER_TASK rays run in parallel on the pool, each with its
+    // own sweep, and draw into the renderer's order-independent light levels,
+    // which are resolved into the frame once every chunk is done.
+    //
+    // With a distance field set, rays that miss the cache are marched
+    // through it instead, and the culler is not consulted.
+    void traceRays(float originX, float originY, const Transform &transform, const WallCuller &culler,
+                   VisibilityBuffer *visibility = nullptr)
+    {
+        const int NUM_RAYS = rayCount(transform.scale);
+        VisibilityBuffer::RayRecord *records = nullptr;
+        Uint32 *litMask = nullptr;
+        Uint32 lightBit = 0;
+        if (visibility)
+        {
+            int light = visibility->addLight({originX, originY}, NUM_RAYS);
+            records = visibility->getRays(light);
+            litMask = visibility->getLitMask();
+            lightBit = VisibilityBuffer::maskBit(light);
+        }
+
+        const bool marching = distanceField != nullptr;
+        if (marching ? distanceField->isOnWall({originX, originY}) : culler.isOriginOnWall())
+        {
+            if (records)
+                std::fill_n(records, NUM_RAYS, VisibilityBuffer::RayRecord{-1, 0.0f});
+            cache.valid = false;
+            return;
+        }
+
+        const float ANGLE_STEP_RAD = 2.0f * PI / NUM_RAYS;
+        const Point screenOrigin = transform.toScreen({originX, originY});
+        const float radius = lightCutoffRadius(renderer.getFalloff());
+        const FrameVector<const Segment *> &walls = culler.getCandidates();
+        const FrameVector<float> &minDistances = culler.getMinDistances();
+
+        const unsigned int sceneVersion = marching ? distanceField->getSceneVersion() : culler.getSceneVersion();
+        const bool reuse = cacheMatches({originX, originY}, transform, sceneVersion, NUM_RAYS);
+        if (static_cast<int>(cache.rays.size()) != NUM_RAYS || !cache.valid)
+            cache.rays.assign(NUM_RAYS, VisibilityBuffer::RayRecord{-1, 0.0f});
+        cache.origin = {originX, originY};
+        cache.transform = transform;
+        cache.width = renderer.getWidth();
+        cache.height = renderer.getHeight();
+        cache.sceneVersion = sceneVersion;
+        cache.falloff = renderer.getFalloff();
+        cache.valid = true;
+
+        ++stats.frames;
+        stats.reusedFrames += reuse;
+        stats.rays += NUM_RAYS;
+        if (!marching)
+            stats.candidateTests += static_cast<size_t>(NUM_RAYS) * walls.size();
+
+        const int chunkCount = (NUM_RAYS + RAYS_PER_TASK - 1) / RAYS_PER_TASK;
+        chunks.assign(chunkCount, RayChunk());
+        pool.parallelFor(chunkCount, [&](int chunk, int)
+        {
+            RayChunk &part = chunks[chunk];
+            const int end = std::min(NUM_RAYS, (chunk + 1) * RAYS_PER_TASK);
+            int previous = -1; // candidate hit by the previous ray
+            for (int i = chunk * RAYS_PER_TASK; i < end; ++i)
+            {
+                // Calculate the angle for this ray
+                float angle = i * ANGLE_STEP_RAD;
+
+                // Check the ray against the walls in reach, starting from the likely winners
+                VisibilityBuffer::RayRecord &cached = cache.rays[i];
+                if (!reuse && marching)
+                {
+                    Hit hit = distanceField->march(Ray(originX, originY, angle), radius, part.stats.marchSteps,
+                                                   part.stats.marchTests);
+                    ++part.stats.marchedRays;
+                    cached = {hit.segment, hit.distance};
+                }
+                else if (!reuse)
+                {
+                    Ray ray(originX, originY, angle);
+                    int seed = culler.findCandidate(cached.segment);
+                    Hit hit = ray.closestHit(walls, minDistances, radius, previous, seed, part.stats.tests);
+                    part.stats.seeded += seed >= 0;
+                    part.stats.seedHits += seed >= 0 && hit.segment == seed;
+                    part.stats.sweepSeeded += previous >= 0;
+                    part.stats.sweepSeedHits += previous >= 0 && hit.segment == previous;
+                    previous = hit.segment;
+                    cached = {hit.isHit() ? culler.sceneIndex(hit.segment) : -1, hit.distance};
+                }
+                if (records)
+                    records[i] = cached;
+
+                // Draw the ray
+                renderer.drawRay(screenOrigin.x, screenOrigin.y, angle, cached.distance * transform.scale,
+                                 transform.scale, part.drawn);
+            }
+        });
+
+        PixelBounds drawn;
+        for (const RayChunk &part : chunks)
+        {
+            stats.seeded += part.stats.seeded;
+            stats.seedHits += part.stats.seedHits;
+            stats.sweepSeeded += part.stats.sweepSeeded;
+            stats.sweepSeedHits += part.stats.sweepSeedHits;
+            stats.tests += part.stats.tests;
+            stats.marchedRays += part.stats.marchedRays;
+            stats.marchSteps += part.stats.marchSteps;
+            stats.marchTests += part.stats.marchTests;
+            drawn.merge(part.drawn);
+        }
+        renderer.resolveRays(drawn, litMask, lightBit);
+    }
+
+    // Closest hits of rayCount rays spread evenly around origin, without
+    // drawing; the coherence seeding of traceRays but no temporal cache, so
+    // lights can be traced in parallel with one culler each
+    static void castRays(Point origin, const WallCuller &culler, int rayCount, float radius,
+                         VisibilityBuffer::RayRecord *records)
+    {
+        if (culler.isOriginOnWall())
+        {
+            std::fill_n(records, rayCount, VisibilityBuffer::RayRecord{-1, 0.0f});
+            return;
+        }
+
+        const float angleStep = 2.0f * PI / rayCount;
+        size_t tests = 0;
+        int previous = -1;
+        for (int i = 0; i < rayCount; ++i)
+        {
+            Ray ray(origin.x, origin.y, i * angleStep);
+            Hit hit = ray.closestHit(culler.getCandidates(), culler.getMinDistances(), radius, previous, -1, tests);
+            previous = hit.segment;
+            records[i] = {hit.isHit() ? culler.sceneIndex(hit.segment) : -1, hit.distance};
+        }
+    }
+
+    // castRays through a distance field instead of a culler
+    static void marchRays(Point origin, const DistanceField &field, int rayCount, float radius,
+                          VisibilityBuffer::RayRecord *records)
+    {
+        if (field.isOnWall(origin))
+        {
+            std::fill_n(records, rayCount, VisibilityBuffer::RayRecord{-1, 0.0f});
+            return;
+        }
+
+        const float angleStep = 2.0f * PI / rayCount;
+        size_t steps = 0, tests = 0;
+        for (int i = 0; i < rayCount; ++i)
+        {
+            Hit hit = field.march(Ray(origin.x, origin.y, i * angleStep), radius, steps, tests);
+            records[i] = {hit.segment, hit.distance};
+        }
+    }
+
+    // Trace an area light as point samples that share one culled wall list
+    // (culled around the centre with the emitter's extent added). Each sample
+    // adds 1/samples of a point light to the renderer's accumulation buffer,
+    // with its ray fan rotated by a fraction of a step so the samples fill in
+    // each other's gaps. Samples walled off from the centre add nothing.
+    void traceAreaLight(const AreaLight &light, float centerX, float centerY, const Transform &transform,
+                        const WallCuller &culler, int samples, unsigned int frame)
+    {
+        if (culler.isOriginOnWall())
+            return;
+
+        const int NUM_RAYS = rayCount(transform.scale);
+        const float ANGLE_STEP_RAD = 2.0f * PI / NUM_RAYS;
+        const float radius = lightCutoffRadius(renderer.getFalloff());
+        const float weight = 1.0f / samples;
+        const FrameVector<const Segment *> &walls = culler.getCandidates();
+
+        for (int s = 0; s < samples; ++s)
+        {
+            Point origin = light.sample({centerX, centerY}, s, samples, frame);
+            float offset = std::hypot(origin.x - centerX, origin.y - centerY);
+            if (offset > 0.0f)
+            {
+                Ray toSample(centerX, centerY, std::atan2(origin.y - centerY, origin.x - centerX));
+                if (toSample.closestHit(walls, offset).isHit())
+                    continue;
+            }
+
+            const Point screenOrigin = transform.toScreen(origin);
+            const float angleOffset = (s + 0.5f) / samples * ANGLE_STEP_RAD;
+            for (int i = 0; i < NUM_RAYS; ++i)
+            {
+                float angle = i * ANGLE_STEP_RAD + angleOffset;
+                Ray ray(origin.x, origin.y, angle);
+                Hit hit = ray.closestHit(walls, radius);
+                renderer.accumulateRay(screenOrigin.x, screenOrigin.y, angle, hit.distance * transform.scale,
+                                       transform.scale, weight, ANGLE_STEP_RAD);
+            }
+        }
+    }
+};
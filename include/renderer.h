@@ -0,0 +1,719 @@
+#pragma once
+
+#include <iostream>
+#include <cstdint>
+#include <SDL.h>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include "scene.h"
+
+// Inclusive pixel-space bounding box, empty until a point is added
+struct PixelBounds
+{
+    int minX = 1, minY = 1, maxX = 0, maxY = 0;
+
+    bool empty() const { return minX > maxX || minY > maxY; }
+
+    void add(int x, int y)
+    {
+        if (empty())
+        {
+            minX = maxX = x;
+            minY = maxY = y;
+            return;
+        }
+        minX = std::min(minX, x);
+        minY = std::min(minY, y);
+        maxX = std::max(maxX, x);
+        maxY = std::max(maxY, y);
+    }
+
+    void merge(const PixelBounds &other)
+    {
+        if (other.empty())
+            return;
+        add(other.minX, other.minY);
+        add(other.maxX, other.maxY);
+    }
+
+    PixelBounds clipped(int width, int height) const
+    {
+        PixelBounds bounds = {std::max(minX, 0), std::max(minY, 0), std::min(maxX, width - 1), std::min(maxY, height - 1)};
+        return bounds;
+    }
+};
+
+// Renderer class to handle drawing operations
+class Renderer
+{
+private:
+    // A wall already transformed to screen space, waiting to be rasterized
+    struct ScreenLine
+    {
+        float x1, y1, x2, y2;
+    };
+
+    SDL_Texture *texture;
+    int pixelPerRow;
+    Uint32 *pixelBuffer;
+    SDL_Renderer *sdlRenderer;
+    int width, height;
+    float falloff; // k in the light's exp(-k * d) falloff, per world unit
+
+    // CPU copy of the texture that all drawing targets, kept across frames so
+    // only the regions that changed are cleared and uploaded. Blending reads
+    // it as ordinary cached memory rather than the driver's mapping, and rows
+    // start on a cache line (pixelPerRow is padded to whole lines).
+    std::vector<Uint32> frameStorage;
+    Uint32 *frameBuffer; // first aligned pixel of frameStorage
+    PixelBounds drawnBounds;         // pixels drawn this frame, walls aside
+    PixelBounds previousDrawnBounds; // the same for the last frame
+    bool fullUpload;                 // texture contents are stale everywhere
+    size_t uploadedPixels;
+    int uploadedFrames;
+
+    // Point light level (ray alpha) per pixel, width * height, shared by the
+    // threads drawing rays. Rays raise a pixel to their own level with an
+    // atomic max, so the result does not depend on the order rays land in or
+    // on which thread drew them.
+    std::vector<std::atomic<Uint8>> lightLevels;
+
+    // Additive light intensity for multi-sample lights, resolved into colour once per frame
+    std::vector<float> lightAccum;
+    std::vector<float> lightHistory; // temporally accumulated intensity
+    PixelBounds accumBounds;         // pixels touched by this frame's accumulation
+    PixelBounds historyBounds;       // pixels holding non-zero history
+
+    std::vector<ScreenLine> lineBatch; // reused across frames
+
+    // Row run of covered pixels in the wall layer
+    struct LayerRun
+    {
+        size_t offset; // y * width + x
+        int length;
+    };
+
+    // Walls prerendered as premultiplied ARGB (alpha is coverage, 0 where
+    // there is no wall), valid for the scene version and view it was drawn with
+    std::vector<Uint32> wallLayer;
+    std::vector<LayerRun> wallRuns;
+    unsigned int wallLayerVersion;
+    Transform wallLayerTransform;
+    bool wallLayerAntialias;
+    bool wallLayerValid;
+    int wallLayerBuilds;
+
+    // Clip a line to the pixel grid, in coordinates where pixel centres are
+    // integers, and note its pixels (and their anti-aliasing neighbours) as
+    // drawn; false if nothing of it is on screen
+    bool clipToPixels(float &x1, float &y1, float &x2, float &y2)
+    {
+        x1 -= 0.5f;
+        y1 -= 0.5f;
+        x2 -= 0.5f;
+        y2 -= 0.5f;
+        const Rect pixelArea = {-0.5f, -0.5f, width - 0.5f - PIXEL_CLIP_EPSILON, height - 0.5f - PIXEL_CLIP_EPSILON};
+        if (!pixelArea.clipSegment(x1, y1, x2, y2))
+            return false;
+
+        PixelBounds line;
+        line.add(pixelIndex(std::min(x1, x2), width) - 1, pixelIndex(std::min(y1, y2), height) - 1);
+        line.add(pixelIndex(std::max(x1, x2), width) + 1, pixelIndex(std::max(y1, y2), height) + 1);
+        drawnBounds.merge(line.clipped(width, height));
+        return true;
+    }
+
+    // Pixel index nearest to a clipped coordinate (>= -0.5, so truncation
+    // rounds), kept in range against rounding
+    static int pixelIndex(float coordinate, int size)
+    {
+        return std::min(size - 1, static_cast<int>(coordinate + 0.5f));
+    }
+
+    // Mix an opaque color into a pixel by coverage. The pixel is flattened
+    // onto black first, as it is displayed, so the result is opaque.
+    static void blendPixel(Uint32 &pixel, Uint32 color, float coverage)
+    {
+        const float alpha = (pixel >> 24) / 255.0f;
+        Uint32 blended = 0xFF000000;
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            float from = ((pixel >> shift) & 0xFF) * alpha;
+            float to = static_cast<float>((color >> shift) & 0xFF);
+            blended |= static_cast<Uint32>(from + (to - from) * coverage + 0.5f) << shift;
+        }
+        pixel = blended;
+    }
+
+    // Premultiplied "over" of color at a coverage onto a layer pixel
+    static void coverPixel(Uint32 &pixel, Uint32 color, float coverage)
+    {
+        Uint32 blended = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            float from = static_cast<float>((pixel >> shift) & 0xFF);
+            float to = static_cast<float>((color >> shift) & 0xFF);
+            blended |= static_cast<Uint32>(from + (to - from) * coverage + 0.5f) << shift;
+        }
+        pixel = blended;
+    }
+
+    // Wu's algorithm, handing each pixel and its coverage to blend
+    template <typename Blend>
+    void smoothLine(float x1, float y1, float x2, float y2, Blend blend)
+    {
+        if (!clipToPixels(x1, y1, x2, y2))
+            return;
+
+        const bool steep = std::fabs(y2 - y1) > std::fabs(x2 - x1);
+        if (steep)
+        {
+            std::swap(x1, y1);
+            std::swap(x2, y2);
+        }
+        if (x1 > x2)
+        {
+            std::swap(x1, x2);
+            std::swap(y1, y2);
+        }
+
+        const int majorSize = steep ? height : width, minorSize = steep ? width : height;
+        const float slope = x2 > x1 ? (y2 - y1) / (x2 - x1) : 0.0f;
+        const int end = pixelIndex(x2, majorSize);
+        for (int major = pixelIndex(x1, majorSize); major <= end; ++major)
+        {
+            float minor = y1 + (major - x1) * slope;
+            int base = static_cast<int>(std::floor(minor));
+            float coverage = minor - base;
+            for (int side = 0; side < 2; ++side)
+            {
+                int index = base + side;
+                if (index < 0 || index >= minorSize)
+                    continue;
+                blend(steep ? pixelBuffer[static_cast<size_t>(major) * pixelPerRow + index]
+                            : pixelBuffer[static_cast<size_t>(index) * pixelPerRow + major],
+                      side ? coverage : 1.0f - coverage);
+            }
+        }
+    }
+
+    // Redraw the walls in view into the wall layer and index its covered runs.
+    // Walls in view are transformed in one batch, then rasterized with the
+    // clipped span (or anti-aliased) line routines.
+    void buildWallLayer(const Scene &scene, const Transform &transform, bool antialias)
+    {
+        const Rect viewport = transform.visibleWorld(width, height);
+        lineBatch.clear();
+        for (const Segment &wall : scene.getWalls())
+        {
+            if (!wall.bounds().intersects(viewport))
+                continue;
+
+            Point a = transform.toScreen({wall.x1, wall.y1});
+            Point b = transform.toScreen({wall.x2, wall.y2});
+            lineBatch.push_back({a.x, a.y, b.x, b.y});
+        }
+
+        // The line routines draw into pixelBuffer; point it at the layer meanwhile
+        wallLayer.assign(static_cast<size_t>(width) * height, 0);
+        Uint32 *framePixels = pixelBuffer;
+        int framePixelPerRow = pixelPerRow;
+        PixelBounds frameDrawn = drawnBounds;
+        pixelBuffer = wallLayer.data();
+        pixelPerRow = width;
+        const Uint32 color = 0xFFFFFFFF;
+        for (const ScreenLine &line : lineBatch)
+        {
+            if (antialias)
+                smoothLine(line.x1, line.y1, line.x2, line.y2,
+                           [color](Uint32 &pixel, float coverage) { coverPixel(pixel, color, coverage); });
+            else
+                drawSpanLine(line.x1, line.y1, line.x2, line.y2, color);
+        }
+        pixelBuffer = framePixels;
+        pixelPerRow = framePixelPerRow;
+        drawnBounds = frameDrawn;
+
+        wallRuns.clear();
+        for (int y = 0; y < height; ++y)
+        {
+            const Uint32 *row = &wallLayer[static_cast<size_t>(y) * width];
+            for (int x = 0; x < width;)
+            {
+                if (!row[x])
+                {
+                    ++x;
+                    continue;
+                }
+                int start = x;
+                while (x < width && row[x])
+                    ++x;
+                wallRuns.push_back({static_cast<size_t>(y) * width + start, x - start});
+            }
+        }
+
+        wallLayerVersion = scene.getVersion();
+        wallLayerTransform = transform;
+        wallLayerAntialias = antialias;
+        wallLayerValid = true;
+        ++wallLayerBuilds;
+        fullUpload = true; // the old walls are gone from the frame too
+    }
+
+public:
+    Renderer(SDL_Renderer *renderer, int width, int height)
+        : texture(nullptr), pixelPerRow(0), pixelBuffer(nullptr), sdlRenderer(renderer), width(0), height(0),
+          falloff(FALLOFF_K), frameBuffer(nullptr), fullUpload(true), uploadedPixels(0), uploadedFrames(0),
+          wallLayerVersion(0), wallLayerTransform({1.0f, 0.0f, 0.0f}), wallLayerAntialias(false), wallLayerValid(false), wallLayerBuilds(0)
+    {
+        resize(width, height);
+    }
+
+    ~Renderer()
+    {
+        if (texture)
+        {
+            SDL_DestroyTexture(texture);
+        }
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+
+    float getFalloff() const { return falloff; }
+    void setFalloff(float k) { falloff = k; }
+
+    // Current frame's pixels, valid between beginFrame and endFrame
+    const Uint32 *getPixels() const { return pixelBuffer; }
+    Uint32 *getPixels() { return pixelBuffer; }
+    int getPixelPerRow() const { return pixelPerRow; }
+
+    // Reallocate the output buffers for a new resolution
+    bool resize(int newWidth, int newHeight)
+    {
+        if (newWidth <= 0 || newHeight <= 0)
+            return false;
+        if (newWidth == width && newHeight == height)
+            return true;
+
+        width = newWidth;
+        height = newHeight;
+        lightLevels = std::vector<std::atomic<Uint8>>(static_cast<size_t>(width) * height);
+        lightAccum.clear();
+        lightHistory.clear();
+        accumBounds = PixelBounds();
+        historyBounds = PixelBounds();
+        wallLayerValid = false;
+        wallRuns.clear();
+        const int linePixels = FRAME_ROW_ALIGNMENT / sizeof(Uint32);
+        pixelPerRow = (width + linePixels - 1) / linePixels * linePixels;
+        frameStorage.assign(static_cast<size_t>(pixelPerRow) * height + linePixels, 0xFF000000);
+        uintptr_t base = reinterpret_cast<uintptr_t>(frameStorage.data());
+        size_t skip = ((base + FRAME_ROW_ALIGNMENT - 1) & ~static_cast<uintptr_t>(FRAME_ROW_ALIGNMENT - 1)) - base;
+        frameBuffer = frameStorage.data() + skip / sizeof(Uint32);
+        drawnBounds = PixelBounds();
+        previousDrawnBounds = PixelBounds();
+        fullUpload = true;
+
+        if (!sdlRenderer)
+            return true;
+
+        if (texture)
+        {
+            SDL_DestroyTexture(texture);
+        }
+        texture = SDL_CreateTexture(
+            sdlRenderer,
+            SDL_PIXELFORMAT_ARGB8888,
+            SDL_TEXTUREACCESS_STREAMING,
+            width,
+            height);
+        if (!texture)
+        {
+            std::cerr << "SDL_CreateTexture Error: " << SDL_GetError() << std::endl;
+            return false;
+        }
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+        return true;
+    }
+
+    // Start a frame as black as a full clear: outside the last frame's drawn
+    // bounds only the walls were drawn, so just those pixels are cleared
+    void beginFrame()
+    {
+        pixelBuffer = frameBuffer;
+        const PixelBounds stale = previousDrawnBounds.clipped(width, height);
+        for (int y = stale.minY; y <= stale.maxY && !stale.empty(); ++y)
+            std::fill_n(pixelBuffer + static_cast<size_t>(y) * pixelPerRow + stale.minX, stale.maxX - stale.minX + 1,
+                        0xFF000000);
+        for (const LayerRun &run : wallRuns)
+            std::fill_n(pixelBuffer + (run.offset / width) * pixelPerRow + run.offset % width, run.length, 0xFF000000);
+        drawnBounds = PixelBounds();
+    }
+
+    // Upload what changed since the last frame, i.e. this frame's and the
+    // last frame's drawn bounds (walls redraw the same pixels unless the
+    // wall layer was rebuilt, which uploads everything), and present it
+    void endFrame()
+    {
+        PixelBounds dirty = drawnBounds;
+        dirty.merge(previousDrawnBounds);
+        if (fullUpload)
+            dirty = {0, 0, width - 1, height - 1};
+        dirty = dirty.clipped(width, height);
+        previousDrawnBounds = drawnBounds;
+        fullUpload = false;
+        ++uploadedFrames;
+        if (!dirty.empty())
+            uploadedPixels += static_cast<size_t>(dirty.maxX - dirty.minX + 1) * (dirty.maxY - dirty.minY + 1);
+
+        if (!sdlRenderer)
+            return;
+
+        if (!dirty.empty())
+        {
+            SDL_Rect rect = {dirty.minX, dirty.minY, dirty.maxX - dirty.minX + 1, dirty.maxY - dirty.minY + 1};
+            const Uint32 *first = pixelBuffer + static_cast<size_t>(dirty.minY) * pixelPerRow + dirty.minX;
+            if (SDL_UpdateTexture(texture, &rect, first, pixelPerRow * static_cast<int>(sizeof(Uint32))) < 0)
+                std::cerr << "SDL_UpdateTexture Error: " << SDL_GetError() << std::endl;
+        }
+        SDL_RenderCopy(sdlRenderer, texture, nullptr, nullptr);
+        SDL_RenderPresent(sdlRenderer);
+    }
+
+    // Note pixels written through getPixels this frame, so they are cleared
+    // next frame and uploaded
+    void markDrawn(const PixelBounds &bounds)
+    {
+        drawnBounds.merge(bounds);
+    }
+
+    // Share of the frame's pixels uploaded per frame, on average
+    double getUploadedFraction() const
+    {
+        return uploadedFrames ? static_cast<double>(uploadedPixels) / (static_cast<double>(width) * height * uploadedFrames)
+                              : 0.0;
+    }
+
+    void clearTexture()
+    {
+        for (int y = 0; y < height; ++y)
+        {
+            std::fill_n(pixelBuffer + static_cast<size_t>(y) * pixelPerRow, width, 0xFF000000);
+        }
+    }
+
+    void drawLine(int x1, int y1, int x2, int y2, Uint32 color)
+    {
+        int dx = std::abs(x2 - x1);
+        int dy = std::abs(y2 - y1);
+        int sx = (x1 < x2) ? 1 : -1;
+        int sy = (y1 < y2) ? 1 : -1;
+        int err = dx - dy;
+
+        PixelBounds line;
+        line.add(x1, y1);
+        line.add(x2, y2);
+        drawnBounds.merge(line.clipped(width, height));
+
+        while (true)
+        {
+            if (x1 >= 0 && x1 < width && y1 >= 0 && y1 < height)
+                pixelBuffer[y1 * pixelPerRow + x1] = color;
+
+            if (x1 == x2 && y1 == y2)
+                break;
+
+            int e2 = 2 * err;
+            if (e2 > -dy)
+            {
+                err -= dy;
+                x1 += sx;
+            }
+            if (e2 < dx)
+            {
+                err += dx;
+                y1 += sy;
+            }
+        }
+    }
+
+    // Draw a line between screen points without per-pixel bounds checks: the
+    // line is clipped to the target first, then written as one run of pixels
+    // per row (a single pixel per row when it is steep). Pixel (x, y) covers
+    // [x, x + 1) x [y, y + 1).
+    void drawSpanLine(float x1, float y1, float x2, float y2, Uint32 color)
+    {
+        if (!clipToPixels(x1, y1, x2, y2))
+            return;
+
+        const bool steep = std::fabs(y2 - y1) > std::fabs(x2 - x1);
+        if (steep)
+        {
+            std::swap(x1, y1);
+            std::swap(x2, y2);
+        }
+        if (x1 > x2)
+        {
+            std::swap(x1, x2);
+            std::swap(y1, y2);
+        }
+
+        const int majorSize = steep ? height : width, minorSize = steep ? width : height;
+        int major = pixelIndex(x1, majorSize);
+        const int majorEnd = pixelIndex(x2, majorSize);
+        int minor = pixelIndex(y1, minorSize);
+        const int minorEnd = pixelIndex(y2, minorSize);
+        if (minor == minorEnd && !steep)
+        {
+            std::fill_n(pixelBuffer + static_cast<size_t>(minor) * pixelPerRow + major, majorEnd - major + 1, color);
+            return;
+        }
+
+        // Runs shorter than two pixels are not worth finding: one pixel per step
+        const float slope = (y2 - y1) / (x2 - x1);
+        if (steep || std::fabs(slope) > 0.5f)
+        {
+            const size_t majorStride = steep ? pixelPerRow : 1, minorStride = steep ? 1 : pixelPerRow;
+            for (; major <= majorEnd; ++major)
+                pixelBuffer[major * majorStride + pixelIndex(y1 + (major - x1) * slope, minorSize) * minorStride] = color;
+            return;
+        }
+
+        // Each run ends at the column where the line crosses into the next row
+        const float inverseSlope = 1.0f / slope;
+        const int step = minorEnd > minor ? 1 : -1;
+        while (major <= majorEnd)
+        {
+            int runEnd = majorEnd;
+            if (minor != minorEnd)
+            {
+                // Columns before the edge (rising) or up to it (falling) stay in this row
+                float edge = x1 + (minor + 0.5f * step - y1) * inverseSlope;
+                int truncated = static_cast<int>(edge);
+                int last = step > 0 ? truncated + (truncated < edge) - 1 : truncated - (truncated > edge);
+                runEnd = std::max(major, std::min(majorEnd, last));
+            }
+            std::fill_n(pixelBuffer + static_cast<size_t>(minor) * pixelPerRow + major, runEnd - major + 1, color);
+            major = runEnd + 1;
+            minor = minor == minorEnd ? minor : minor + step;
+        }
+    }
+
+    // Anti-aliased line (Wu): every step along the major axis splits the
+    // color between the two pixels straddling the line by their distance
+    void drawSmoothLine(float x1, float y1, float x2, float y2, Uint32 color)
+    {
+        smoothLine(x1, y1, x2, y2, [color](Uint32 &pixel, float coverage) { blendPixel(pixel, color, coverage); });
+    }
+
+    // Draw a ray from a screen-space origin into the light levels; distance
+    // is in screen pixels and the falloff is evaluated in world units so the
+    // light keeps its size at any scale. Where rays overlap the brightest
+    // wins. Threads may draw at the same time; drawn is widened to the pixels
+    // the ray lit, for resolveRays.
+    void drawRay(float x1, float y1, float angle, float distance, float scale, PixelBounds &drawn)
+    {
+        std::atomic<Uint8> *levels = lightLevels.data();
+        float stepSize = 1.0f;
+        float stepX = std::cos(angle) * stepSize;
+        float stepY = std::sin(angle) * stepSize;
+        float currentX = x1;
+        float currentY = y1;
+
+        // exp(-k * d) evaluated incrementally, one multiply per pixel instead of an expf
+        float attenuation = 1.0f;
+        const float stepAttenuation = expf(-falloff * stepSize / scale);
+
+        int lastX = -1, lastY = -1;
+        for (float d = 0.0f; d <= distance; d += stepSize)
+        {
+            Uint8 alpha = static_cast<Uint8>(attenuation * 255.0f);
+
+            if (alpha == 0)
+            {
+                break;
+            }
+
+            int drawX = static_cast<int>(currentX);
+            int drawY = static_cast<int>(currentY);
+
+            if (drawX <= 0 || drawX >= width || drawY <= 0 || drawY >= height)
+            {
+                break;
+            }
+
+            std::atomic<Uint8> &level = levels[static_cast<size_t>(drawY) * width + drawX];
+            Uint8 current = level.load(std::memory_order_relaxed);
+            while (current < alpha && !level.compare_exchange_weak(current, alpha, std::memory_order_relaxed))
+            {
+            }
+            lastX = drawX;
+            lastY = drawY;
+            currentX += stepX;
+            currentY += stepY;
+            attenuation *= stepAttenuation;
+        }
+
+        // A ray is straight, so its end points bound everything it drew
+        if (lastX >= 0)
+        {
+            drawn.add(static_cast<int>(x1), static_cast<int>(y1));
+            drawn.add(lastX, lastY);
+        }
+    }
+
+    // Colour the pixels inside bounds from the light levels drawRay left,
+    // and clear the levels for the next light. When litMask (width * height)
+    // is given, lightBit is set on every lit pixel.
+    void resolveRays(const PixelBounds &bounds, Uint32 *litMask = nullptr, Uint32 lightBit = 0)
+    {
+        const PixelBounds region = bounds.clipped(width, height);
+        drawnBounds.merge(region);
+        for (int y = region.minY; y <= region.maxY && !region.empty(); ++y)
+        {
+            const size_t row = static_cast<size_t>(y) * width;
+            Uint32 *pixelRow = pixelBuffer + static_cast<size_t>(y) * pixelPerRow;
+            std::atomic<Uint8> *levelRow = &lightLevels[row];
+            for (int x = region.minX; x <= region.maxX; ++x)
+            {
+                Uint32 alpha = levelRow[x].load(std::memory_order_relaxed);
+                if (alpha == 0)
+                    continue;
+                levelRow[x].store(0, std::memory_order_relaxed);
+                pixelRow[x] = (alpha << 24) | (255 << 16) | (255 << 8) | 102;
+                if (litMask)
+                    litMask[static_cast<size_t>(y) * width + x] |= lightBit;
+            }
+        }
+    }
+
+    // Like drawRay, but adds weight * attenuation to the light accumulation
+    // buffer instead of writing colour, so several sample rays can overlap.
+    // Near the origin neighbouring rays share pixels, so each ray only adds
+    // the share of a pixel its angular step covers at that distance.
+    void accumulateRay(float x1, float y1, float angle, float distance, float scale, float weight, float angleStep)
+    {
+        if (lightAccum.empty())
+            lightAccum.assign(static_cast<size_t>(width) * height, 0.0f);
+
+        float stepX = std::cos(angle);
+        float stepY = std::sin(angle);
+        float currentX = x1;
+        float currentY = y1;
+        float attenuation = weight;
+        const float stepAttenuation = expf(-falloff / scale);
+        const float minAttenuation = MIN_ALPHA * weight;
+        float coverage = 0.5f * angleStep;
+
+        int lastX = -1, lastY = -1;
+        for (float d = 0.0f; d <= distance && attenuation >= minAttenuation; d += 1.0f)
+        {
+            int drawX = static_cast<int>(currentX);
+            int drawY = static_cast<int>(currentY);
+            if (drawX <= 0 || drawX >= width || drawY <= 0 || drawY >= height)
+                break;
+
+            lightAccum[static_cast<size_t>(drawY) * width + drawX] += attenuation * coverage;
+            coverage = std::min(1.0f, coverage + angleStep);
+            lastX = drawX;
+            lastY = drawY;
+            currentX += stepX;
+            currentY += stepY;
+            attenuation *= stepAttenuation;
+        }
+
+        // A ray is straight, so its end points bound everything it touched
+        if (lastX >= 0)
+        {
+            accumBounds.add(static_cast<int>(x1), static_cast<int>(y1));
+            accumBounds.add(lastX, lastY);
+        }
+    }
+
+    // Turn the accumulated intensity into ray colour. historyWeight blends in
+    // the previous frames' result (0 restarts the history); the accumulation
+    // buffer is cleared for the next frame.
+    void resolveLight(float historyWeight)
+    {
+        if (lightAccum.empty())
+            return;
+        if (lightHistory.empty())
+            lightHistory.assign(static_cast<size_t>(width) * height, 0.0f);
+
+        PixelBounds region = accumBounds;
+        region.merge(historyBounds);
+        region = region.clipped(width, height);
+        historyBounds = historyWeight > 0.0f ? region : accumBounds.clipped(width, height);
+        drawnBounds.merge(region);
+
+        for (int y = region.minY; y <= region.maxY && !region.empty(); ++y)
+        {
+            float *accumRow = &lightAccum[static_cast<size_t>(y) * width];
+            float *historyRow = &lightHistory[static_cast<size_t>(y) * width];
+            Uint32 *pixelRow = pixelBuffer + static_cast<size_t>(y) * pixelPerRow;
+            for (int x = region.minX; x <= region.maxX; ++x)
+            {
+                float intensity = historyWeight * historyRow[x] + (1.0f - historyWeight) * accumRow[x];
+                historyRow[x] = intensity;
+                accumRow[x] = 0.0f;
+
+                Uint32 alpha = static_cast<Uint32>(std::min(intensity, 1.0f) * 255.0f);
+                if (alpha > 0)
+                    pixelRow[x] = (alpha << 24) | (255 << 16) | (255 << 8) | 102;
+            }
+        }
+        accumBounds = PixelBounds();
+    }
+
+    // Composite the walls over the frame from the cached wall layer, which is
+    // redrawn only when the scene, the view or the output size changed; only
+    // the layer's covered runs are touched
+    void drawWalls(const Scene &scene, const Transform &transform, bool antialias = false)
+    {
+        if (!wallLayerValid || wallLayerVersion != scene.getVersion() || wallLayerAntialias != antialias ||
+            wallLayerTransform.scale != transform.scale || wallLayerTransform.offsetX != transform.offsetX ||
+            wallLayerTransform.offsetY != transform.offsetY)
+            buildWallLayer(scene, transform, antialias);
+
+        for (const LayerRun &run : wallRuns)
+        {
+            const Uint32 *layer = &wallLayer[run.offset];
+            Uint32 *pixel = pixelBuffer + (run.offset / width) * pixelPerRow + run.offset % width;
+            for (int i = 0; i < run.length; ++i)
+            {
+                Uint32 cover = layer[i];
+                if ((cover >> 24) == 0xFF)
+                {
+                    pixel[i] = cover;
+                    continue;
+                }
+
+                // Premultiplied over the frame pixel flattened onto black
+                float frameAlpha = (pixel[i] >> 24) / 255.0f;
+                float remaining = 1.0f - (cover >> 24) / 255.0f;
+                Uint32 blended = 0xFF000000;
+                for (int shift = 0; shift < 24; shift += 8)
+                {
+                    float under = ((pixel[i] >> shift) & 0xFF) * frameAlpha;
+                    blended |= static_cast<Uint32>(((cover >> shift) & 0xFF) + under * remaining + 0.5f) << shift;
+                }
+                pixel[i] = blended;
+            }
+        }
+    }
+
+    // Times the wall layer was redrawn
+    int getWallLayerBuilds() const { return wallLayerBuilds; }
+
+    // Pixels drawWalls composites per call: the length of the layer's covered runs
+    size_t getWallLayerPixels() const
+    {
+        size_t pixels = 0;
+        for (const LayerRun &run : wallRuns)
+            pixels += run.length;
+        return pixels;
+    }
+};
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "geometry.h"
+
+// 64-bit FNV-1a hash of size bytes
+inline uint64_t fnv1a(const char *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// A version no Scene has had yet. Versions are unique across scenes, so a
+// scene replaced in place never matches caches built for the walls it had.
+inline unsigned int nextSceneVersion()
+{
+    static std::atomic<unsigned int> latest(0);
+    return ++latest;
+}
+
+// Opening from one sector into a neighbouring one
+struct Portal
+{
+    Point a, b;
+    int sector; // index into Scene::getSectors()
+};
+
+// Convex room of an indoor map: its outline, the walls lying on its boundary
+// and the portals leading out of it
+struct Sector
+{
+    std::vector<Point> outline; // convex polygon, either winding
+    std::vector<int> walls;     // indices into Scene::getWalls()
+    std::vector<Portal> portals;
+
+    // Whether p is inside or on the outline
+    bool contains(Point p) const
+    {
+        bool negative = false, positive = false;
+        for (size_t i = 0; i < outline.size(); ++i)
+        {
+            const Point &a = outline[i], &b = outline[(i + 1) % outline.size()];
+            float cross = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+            negative |= cross < 0.0f;
+            positive |= cross > 0.0f;
+        }
+        return !(negative && positive);
+    }
+};
+
+// Scene class to manage walls
+class Scene
+{
+private:
+    std::vector<Segment> walls;
+    std::vector<Sector> sectors;                // optional sector graph, empty when the walls have none
+    std::vector<Point> lights;                  // static lights besides the one following the mouse
+    unsigned int version = nextSceneVersion(); // renewed whenever the walls change
+    uint64_t sourceHash = 0;                    // FNV-1a of the scene file the walls were loaded from, 0 otherwise
+
+public:
+    Scene()
+    {
+        // Define the scene with walls
+        walls = {
+            Segment(400, 400, 500, 500),
+            Segment(300, 100, 300, 300),
+            Segment(500, 600, 400, 500),
+            Segment(300, 300, 100, 300),
+            Segment(100, 300, 100, 100),
+            Segment(600, 150, 600, 450), // mur vertical à droite
+            Segment(200, 450, 200, 150)  // mur vertical à gauche
+        };
+    }
+
+    const std::vector<Segment> &getWalls() const
+    {
+        return walls;
+    }
+
+    const std::vector<Sector> &getSectors() const
+    {
+        return sectors;
+    }
+
+    const std::vector<Point> &getLights() const
+    {
+        return lights;
+    }
+
+    // Replace the static lights with count lights spread over an area
+    void scatterLights(int count, const Rect &box)
+    {
+        lights.clear();
+        unsigned int seed = 54321;
+        auto nextUnit = [&seed]()
+        {
+            seed = seed * 1103515245u + 12345u;
+            return ((seed >> 16) & 0x7FFF) / 32768.0f;
+        };
+        for (int i = 0; i < count; ++i)
+        {
+            float x = box.minX + nextUnit() * (box.maxX - box.minX);
+            float y = box.minY + nextUnit() * (box.maxY - box.minY);
+            lights.push_back({x, y});
+        }
+    }
+
+    unsigned int getVersion() const
+    {
+        return version;
+    }
+
+    uint64_t getSourceHash() const
+    {
+        return sourceHash;
+    }
+
+    void setWalls(std::vector<Segment> &&newWalls)
+    {
+        walls = std::move(newWalls);
+        sectors.clear();
+        sourceHash = 0;
+        version = nextSceneVersion();
+    }
+
+    // Replace the walls and static lights with those of a text scene file,
+    // one `wall X1 Y1 X2 Y2` or `light X Y` per line (# starts a comment).
+    // The scene is left unchanged when the file cannot be read.
+    bool loadText(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::cerr << "Could not open scene file " << path << std::endl;
+            return false;
+        }
+        // Read whole, so the hash is of exactly the text parsed
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        const std::string text = contents.str();
+
+        std::vector<Segment> newWalls;
+        std::vector<Point> newLights;
+        std::istringstream lines(text);
+        std::string line;
+        for (int lineNumber = 1; std::getline(lines, line); ++lineNumber)
+        {
+            std::istringstream fields(line.substr(0, line.find('#')));
+            std::string kind, extra;
+            if (!(fields >> kind))
+                continue;
+
+            float x1, y1, x2, y2;
+            if (kind == "wall" && fields >> x1 >> y1 >> x2 >> y2 && !(fields >> extra))
+            {
+                newWalls.push_back(Segment(x1, y1, x2, y2));
+            }
+            else if (kind == "light" && fields >> x1 >> y1 && !(fields >> extra))
+            {
+                newLights.push_back({x1, y1});
+            }
+            else
+            {
+                std::cerr << path << ":" << lineNumber << ": expected `wall X1 Y1 X2 Y2` or `light X Y`" << std::endl;
+                return false;
+            }
+        }
+
+        setWalls(std::move(newWalls));
+        lights = std::move(newLights);
+        sourceHash = fnv1a(text.data(), text.size());
+        return true;
+    }
+
+    // Sector containing p, or -1 when it is outside all of them
+    int sectorAt(Point p) const
+    {
+        for (size_t i = 0; i < sectors.size(); ++i)
+        {
+            if (sectors[i].contains(p))
+                return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    // Replace the walls with a cols x rows grid of rooms joined by doorways,
+    // each room a sector with portals through its doorways
+    void generateRooms(int cols, int rows)
+    {
+        walls.clear();
+        sectors.assign(static_cast<size_t>(cols) * rows, Sector());
+        sourceHash = 0;
+        version = nextSceneVersion();
+        unsigned int seed = 12345;
+        auto nextRandom = [&seed]()
+        {
+            seed = seed * 1103515245u + 12345u;
+            return (seed >> 16) & 0x7FFF;
+        };
+
+        // Edge from (x, y) along +x or +y between rooms `before` and `after`
+        // (-1 outside the grid), split around a doorway unless it is solid
+        auto addEdge = [this](float x, float y, bool horizontal, bool door, int before, int after)
+        {
+            size_t first = walls.size();
+            float half = (ROOM_SIZE - DOOR_WIDTH) * 0.5f;
+            if (!door)
+            {
+                walls.push_back(horizontal ? Segment(x, y, x + ROOM_SIZE, y) : Segment(x, y, x, y + ROOM_SIZE));
+            }
+            else if (horizontal)
+            {
+                walls.push_back(Segment(x, y, x + half, y));
+                walls.push_back(Segment(x + ROOM_SIZE - half, y, x + ROOM_SIZE, y));
+            }
+            else
+            {
+                walls.push_back(Segment(x, y, x, y + half));
+                walls.push_back(Segment(x, y + ROOM_SIZE - half, x, y + ROOM_SIZE));
+            }
+
+            for (int room : {before, after})
+            {
+                if (room < 0)
+                    continue;
+                for (size_t wall = first; wall < walls.size(); ++wall)
+                    sectors[room].walls.push_back(static_cast<int>(wall));
+            }
+            if (door)
+            {
+                Point a = horizontal ? Point{x + half, y} : Point{x, y + half};
+                Point b = horizontal ? Point{x + ROOM_SIZE - half, y} : Point{x, y + ROOM_SIZE - half};
+                sectors[before].portals.push_back({a, b, after});
+                sectors[after].portals.push_back({a, b, before});
+            }
+        };
+
+        for (int row = 0; row <= rows; ++row)
+        {
+            for (int col = 0; col <= cols; ++col)
+            {
+                float x = col * ROOM_SIZE;
+                float y = row * ROOM_SIZE;
+                int room = row < rows && col < cols ? row * cols + col : -1;
+                if (col < cols)
+                    addEdge(x, y, true, row > 0 && row < rows && nextRandom() % 3 != 0,
+                            row > 0 ? (row - 1) * cols + col : -1, room);
+                if (row < rows)
+                    addEdge(x, y, false, col > 0 && col < cols && nextRandom() % 3 != 0,
+                            col > 0 ? row * cols + col - 1 : -1, room);
+                if (room >= 0)
+                    sectors[room].outline = {{x, y}, {x + ROOM_SIZE, y}, {x + ROOM_SIZE, y + ROOM_SIZE}, {x, y + ROOM_SIZE}};
+            }
+        }
+    }
+
+    Rect bounds() const
+    {
+        Rect box = {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(),
+                    -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()};
+        for (const Segment &wall : walls)
+        {
+            Rect wallBox = wall.bounds();
+            box = {std::min(box.minX, wallBox.minX), std::min(box.minY, wallBox.minY),
+                   std::max(box.maxX, wallBox.maxX), std::max(box.maxY, wallBox.maxY)};
+        }
+        return box;
+    }
+
+    bool isPointOnSegment(int x, int y, const Segment &wall) const
+    {
+        float dx = wall.x2 - wall.x1;
+        float dy = wall.y2 - wall.y1;
+        float cross = (x - wall.x1) * dy - (y - wall.y1) * dx;
+        if (std::fabs(cross) > 0)
+            return false;
+
+        // Check if pt is between wall.x1,y1 and wall.x2,y2 using the bounding box method.
+        float minX = std::min(wall.x1, wall.x2);
+        float maxX = std::max(wall.x1, wall.x2);
+        float minY = std::min(wall.y1, wall.y2);
+        float maxY = std::max(wall.y1, wall.y2);
+
+        if (x < minX || x > maxX || y < minY || y > maxY)
+        {
+            return false;
+        }
+
+        return true;
+    }
+};
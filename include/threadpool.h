@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// Fixed set of worker threads for data-parallel loops. parallelFor hands out
+// indices one at a time until all have run, and the calling thread works as
+// worker 0, so worker indices line up with FrameArena::worker().
+class ThreadPool
+{
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+
+    // The current job, fn(index, worker), called through a trampoline so the
+    // callable is only referenced and never copied into an allocation
+    void (*job)(const void *fn, int index, int worker);
+    const void *jobFn;
+    std::atomic<int> next;
+    int count;
+    int busy;                // helper threads still inside the current job
+    unsigned int generation; // bumped for every job so helpers run each once
+    bool stopping;
+
+    template <typename Fn>
+    static void invoke(const void *fn, int index, int worker)
+    {
+        (*static_cast<const Fn *>(fn))(index, worker);
+    }
+
+    void work(int worker)
+    {
+        for (int index = next++; index < count; index = next++)
+            job(jobFn, index, worker);
+    }
+
+    void helperLoop(int worker)
+    {
+        unsigned int seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this, seen]() { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+
+            work(worker);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0)
+                finished.notify_one();
+        }
+    }
+
+public:
+    explicit ThreadPool(int workerCount)
+        : job(nullptr), jobFn(nullptr), next(0), count(0), busy(0), generation(0), stopping(false)
+    {
+        for (int worker = 1; worker < std::max(workerCount, 1); ++worker)
+            threads.emplace_back(&ThreadPool::helperLoop, this, worker);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    int getWorkerCount() const { return static_cast<int>(threads.size()) + 1; }
+
+    // Run fn(index, worker) for every index in [0, indexCount) and wait for all of them
+    template <typename Fn>
+    void parallelFor(int indexCount, const Fn &fn)
+    {
+        if (indexCount <= 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &ThreadPool::invoke<Fn>;
+            jobFn = &fn;
+            next = 0;
+            count = indexCount;
+            busy = static_cast<int>(threads.size());
+            ++generation;
+        }
+        wake.notify_all();
+
+        work(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]() { return busy == 0; });
+        job = nullptr;
+        jobFn = nullptr;
+    }
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include "constants.h"
+#include "geometry.h"
+#include "arena.h"
+#include "renderer.h"
+#include "visibility.h"
+#include "threadpool.h"
+
+// Shading for scenes with many lights. Lights are binned into square screen
+// tiles by what they can see: each light's rays are reduced to their nearest
+// and farthest reach per angular sector, and a tile only gets the lights with
+// a sector facing it that reaches it. The tiles are then shaded in parallel,
+// each pixel only looking at its tile's lights. A light reaches a pixel when
+// the pixel is nearer than the wall hit by the light's ray toward it, read
+// from the frame's visibility buffer; that lookup is skipped for tiles lying
+// wholly within the light's nearest reach.
+class TiledLighting
+{
+private:
+    ThreadPool &pool;
+    size_t binnedCount; // light-tile pairs in the last frame
+    int litTileCount;   // tiles with at least one light in the last frame
+
+    enum Coverage
+    {
+        COVER_NONE,
+        COVER_PARTIAL,
+        COVER_FULL // every point of the box is in view of the light
+    };
+
+    // How much of a world rectangle a light sees, from its nearest and
+    // farthest ray reach per sector
+    static Coverage coverage(Point origin, const float *nearReach, const float *farReach, const Rect &box)
+    {
+        float farX = std::max(origin.x - box.minX, box.maxX - origin.x);
+        float farY = std::max(origin.y - box.minY, box.maxY - origin.y);
+        float farthest = std::hypot(farX, farY);
+        if (box.contains(origin))
+        {
+            float nearest = *std::min_element(nearReach, nearReach + LIGHT_REACH_SECTORS);
+            return farthest <= nearest ? COVER_FULL : COVER_PARTIAL;
+        }
+
+        float nearestX = std::max(box.minX, std::min(origin.x, box.maxX));
+        float nearestY = std::max(box.minY, std::min(origin.y, box.maxY));
+        float distance = std::hypot(nearestX - origin.x, nearestY - origin.y);
+
+        // Directions to the corners, relative to the direction of the centre
+        float centre = std::atan2((box.minY + box.maxY) * 0.5f - origin.y, (box.minX + box.maxX) * 0.5f - origin.x);
+        float low = 0.0f, high = 0.0f;
+        const Point corners[4] = {{box.minX, box.minY}, {box.maxX, box.minY}, {box.minX, box.maxY}, {box.maxX, box.maxY}};
+        for (const Point &corner : corners)
+        {
+            float offset = AngleRange::wrap(std::atan2(corner.y - origin.y, corner.x - origin.x) - centre + PI) - PI;
+            low = std::min(low, offset);
+            high = std::max(high, offset);
+        }
+
+        const float sectorWidth = 2.0f * PI / LIGHT_REACH_SECTORS;
+        int first = static_cast<int>(std::floor(AngleRange::wrap(centre + low) / sectorWidth));
+        int count = std::min(static_cast<int>((high - low) / sectorWidth) + 2, LIGHT_REACH_SECTORS);
+        bool any = false, all = true;
+        for (int i = 0; i < count; ++i)
+        {
+            int sector = (first + i) % LIGHT_REACH_SECTORS;
+            any |= farReach[sector] >= distance;
+            all &= nearReach[sector] >= farthest;
+        }
+        return all ? COVER_FULL : any ? COVER_PARTIAL : COVER_NONE;
+    }
+
+public:
+    TiledLighting(ThreadPool &pool) : pool(pool), binnedCount(0), litTileCount(0) {}
+
+    // Light the frame from every light in the visibility buffer
+    void shade(Renderer &renderer, VisibilityBuffer &visibility, const Transform &transform, Arena &arena)
+    {
+        const int width = renderer.getWidth(), height = renderer.getHeight();
+        const int tilesX = (width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+        const int tilesY = (height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+        const int tileCount = tilesX * tilesY;
+        const int lightCount = visibility.getLightCount();
+        const float falloff = renderer.getFalloff();
+        const float radius = lightCutoffRadius(falloff);
+
+        // Nearest and farthest reach of each light per sector, LIGHT_REACH_SECTORS per light
+        const size_t reachSize = static_cast<size_t>(lightCount) * LIGHT_REACH_SECTORS;
+        FrameVector<float> nearReach(reachSize, radius, ArenaAllocator<float>(arena));
+        FrameVector<float> farReach(reachSize, 0.0f, ArenaAllocator<float>(arena));
+        pool.parallelFor(lightCount, [&](int light, int)
+        {
+            const VisibilityBuffer::RayRecord *rays = visibility.getRays(light);
+            const int rayCount = visibility.getRayCount(light);
+            float *lightNear = &nearReach[static_cast<size_t>(light) * LIGHT_REACH_SECTORS];
+            float *lightFar = &farReach[static_cast<size_t>(light) * LIGHT_REACH_SECTORS];
+            for (int ray = 0; ray < rayCount; ++ray)
+            {
+                size_t sector = static_cast<size_t>(ray) * LIGHT_REACH_SECTORS / rayCount;
+                lightNear[sector] = std::min(lightNear[sector], rays[ray].distance);
+                lightFar[sector] = std::max(lightFar[sector], rays[ray].distance);
+            }
+
+            // Pixels near a sector edge read the neighbouring sector's edge ray, so fold neighbours in
+            float nearFirst = lightNear[0], farFirst = lightFar[0];
+            float nearPrevious = lightNear[LIGHT_REACH_SECTORS - 1], farPrevious = lightFar[LIGHT_REACH_SECTORS - 1];
+            for (int sector = 0; sector < LIGHT_REACH_SECTORS; ++sector)
+            {
+                float nearNext = sector + 1 < LIGHT_REACH_SECTORS ? lightNear[sector + 1] : nearFirst;
+                float farNext = sector + 1 < LIGHT_REACH_SECTORS ? lightFar[sector + 1] : farFirst;
+                float nearHere = lightNear[sector], farHere = lightFar[sector];
+                lightNear[sector] = std::min(std::min(nearPrevious, nearHere), nearNext);
+                lightFar[sector] = std::max(std::max(farPrevious, farHere), farNext);
+                nearPrevious = nearHere;
+                farPrevious = farHere;
+            }
+        });
+
+        // Light-tile pairs, then a counting sort by tile: tile t's lights are
+        // tileLights[tileStart[t]] up to tileLights[tileStart[t + 1]], with
+        // wholly lit ones stored as ~light
+        FrameVector<int> tileStart(static_cast<size_t>(tileCount) + 1, 0, ArenaAllocator<int>(arena));
+        FrameVector<std::pair<int, int>> pairs{ArenaAllocator<std::pair<int, int>>(arena)};
+        for (int light = 0; light < lightCount; ++light)
+        {
+            const Point origin = visibility.getOrigin(light);
+            const float *lightNear = &nearReach[static_cast<size_t>(light) * LIGHT_REACH_SECTORS];
+            const float *lightFar = &farReach[static_cast<size_t>(light) * LIGHT_REACH_SECTORS];
+            const float lightReach = *std::max_element(lightFar, lightFar + LIGHT_REACH_SECTORS);
+            const Point screenOrigin = transform.toScreen(origin);
+            const float screenReach = lightReach * transform.scale;
+            const int minX = std::max(static_cast<int>(std::floor((screenOrigin.x - screenReach) / LIGHT_TILE_SIZE)), 0);
+            const int minY = std::max(static_cast<int>(std::floor((screenOrigin.y - screenReach) / LIGHT_TILE_SIZE)), 0);
+            const int maxX = std::min(static_cast<int>(std::floor((screenOrigin.x + screenReach) / LIGHT_TILE_SIZE)), tilesX - 1);
+            const int maxY = std::min(static_cast<int>(std::floor((screenOrigin.y + screenReach) / LIGHT_TILE_SIZE)), tilesY - 1);
+            for (int y = minY; y <= maxY; ++y)
+            {
+                for (int x = minX; x <= maxX; ++x)
+                {
+                    Point topLeft = transform.toWorld({static_cast<float>(x * LIGHT_TILE_SIZE), static_cast<float>(y * LIGHT_TILE_SIZE)});
+                    Point bottomRight = transform.toWorld({static_cast<float>((x + 1) * LIGHT_TILE_SIZE),
+                                                           static_cast<float>((y + 1) * LIGHT_TILE_SIZE)});
+                    Coverage seen = coverage(origin, lightNear, lightFar, {topLeft.x, topLeft.y, bottomRight.x, bottomRight.y});
+                    if (seen == COVER_NONE)
+                        continue;
+                    pairs.push_back({y * tilesX + x, seen == COVER_FULL ? ~light : light});
+                    ++tileStart[y * tilesX + x + 1];
+                }
+            }
+        }
+        for (size_t tile = 1; tile < tileStart.size(); ++tile)
+            tileStart[tile] += tileStart[tile - 1];
+
+        FrameVector<int> tileLights(pairs.size(), 0, ArenaAllocator<int>(arena));
+        FrameVector<int> cursor(tileStart.begin(), tileStart.end() - 1, ArenaAllocator<int>(arena));
+        for (const std::pair<int, int> &pair : pairs)
+            tileLights[cursor[pair.first]++] = pair.second;
+
+        binnedCount = tileLights.size();
+        litTileCount = 0;
+        PixelBounds litBounds;
+        for (int tile = 0; tile < tileCount; ++tile)
+        {
+            if (tileStart[tile + 1] == tileStart[tile])
+                continue;
+            ++litTileCount;
+            litBounds.add((tile % tilesX) * LIGHT_TILE_SIZE, (tile / tilesX) * LIGHT_TILE_SIZE);
+            litBounds.add((tile % tilesX + 1) * LIGHT_TILE_SIZE - 1, (tile / tilesX + 1) * LIGHT_TILE_SIZE - 1);
+        }
+        renderer.markDrawn(litBounds.clipped(width, height));
+
+        Uint32 *pixels = renderer.getPixels();
+        const int pixelPerRow = renderer.getPixelPerRow();
+        Uint32 *litMask = visibility.getLitMask();
+        const float radiusSquared = radius * radius;
+
+        pool.parallelFor(tileCount, [&](int tile, int)
+        {
+            const int first = tileStart[tile], last = tileStart[tile + 1];
+            if (first == last)
+                return;
+
+            const int x0 = (tile % tilesX) * LIGHT_TILE_SIZE, y0 = (tile / tilesX) * LIGHT_TILE_SIZE;
+            const int x1 = std::min(x0 + LIGHT_TILE_SIZE, width), y1 = std::min(y0 + LIGHT_TILE_SIZE, height);
+            for (int y = y0; y < y1; ++y)
+            {
+                for (int x = x0; x < x1; ++x)
+                {
+                    const Point world = transform.toWorld({x + 0.5f, y + 0.5f});
+                    float intensity = 0.0f;
+                    Uint32 mask = 0;
+                    for (int i = first; i < last; ++i)
+                    {
+                        const bool wholly = tileLights[i] < 0;
+                        const int light = wholly ? ~tileLights[i] : tileLights[i];
+                        const Point origin = visibility.getOrigin(light);
+                        const float dx = world.x - origin.x, dy = world.y - origin.y;
+                        const float distanceSquared = dx * dx + dy * dy;
+                        if (distanceSquared > radiusSquared)
+                            continue;
+                        const float distance = std::sqrt(distanceSquared);
+                        if (!wholly && distance > visibility.rayToward(light, std::atan2(dy, dx)).distance)
+                            continue;
+                        intensity += std::exp(-falloff * distance);
+                        mask |= VisibilityBuffer::maskBit(light);
+                    }
+
+                    Uint32 alpha = static_cast<Uint32>(std::min(intensity, 1.0f) * 255.0f);
+                    if (alpha > 0)
+                        pixels[static_cast<size_t>(y) * pixelPerRow + x] = (alpha << 24) | (255 << 16) | (255 << 8) | 102;
+                    litMask[static_cast<size_t>(y) * width + x] |= mask;
+                }
+            }
+        });
+    }
+
+    size_t getBinnedCount() const { return binnedCount; }
+    int getLitTileCount() const { return litTileCount; }
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <SDL.h>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "constants.h"
+#include "geometry.h"
+
+// Optional auxiliary outputs of the tracing pass (a small G-buffer): for each
+// light, the wall and distance hit by every ray, and per pixel a bitmask of
+// the lights reaching it. They are written by the same pass that draws the
+// rays, so gameplay and analytics code can query the current frame's
+// visibility without retracing. Results stay valid until the next frame.
+class VisibilityBuffer
+{
+public:
+    struct RayRecord
+    {
+        int segment;    // index into Scene::getWalls(), -1 if the ray reached the light radius
+        float distance; // world units
+    };
+
+private:
+    struct LightRays
+    {
+        Point origin;
+        float angleStep;
+        std::vector<RayRecord> rays;
+    };
+
+    std::vector<LightRays> lights;
+    std::vector<Uint32> litMask; // bit i set where light i (one of the first MAX_VISIBILITY_LIGHTS) lit a pixel
+    int width, height;
+    int lightCount;
+
+public:
+    VisibilityBuffer() : width(0), height(0), lightCount(0) {}
+
+    // Size the buffers for this frame and clear the pixel masks
+    void beginFrame(int screenWidth, int screenHeight)
+    {
+        width = screenWidth;
+        height = screenHeight;
+        litMask.assign(static_cast<size_t>(width) * height, 0);
+        lightCount = 0;
+    }
+
+    // Reserve the ray records for the next light and return its index.
+    // Lights past the first MAX_VISIBILITY_LIGHTS get no lit mask bit.
+    int addLight(Point origin, int rayCount)
+    {
+        if (static_cast<int>(lights.size()) <= lightCount)
+            lights.resize(lightCount + 1);
+        LightRays &light = lights[lightCount];
+        light.origin = origin;
+        light.angleStep = 2.0f * PI / rayCount;
+        light.rays.resize(rayCount);
+        return lightCount++;
+    }
+
+    RayRecord *getRays(int light) { return lights[light].rays.data(); }
+    const RayRecord *getRays(int light) const { return lights[light].rays.data(); }
+
+    Point getOrigin(int light) const { return lights[light].origin; }
+
+    int getRayCount(int light) const { return static_cast<int>(lights[light].rays.size()); }
+
+    // Lit mask bit of a light, 0 if it has none
+    static Uint32 maskBit(int light) { return light < MAX_VISIBILITY_LIGHTS ? 1u << light : 0u; }
+
+    Uint32 *getLitMask() { return litMask.data(); }
+
+    int getLightCount() const { return lightCount; }
+
+    // Lights reaching screen pixel (x, y), one bit per light
+    Uint32 litBy(int x, int y) const
+    {
+        if (x < 0 || x >= width || y < 0 || y >= height)
+            return 0;
+        return litMask[static_cast<size_t>(y) * width + x];
+    }
+
+    // The ray record of a light nearest to a direction
+    const RayRecord &rayToward(int light, float angle) const
+    {
+        const LightRays &rays = lights[light];
+        float turns = angle / rays.angleStep;
+        int count = static_cast<int>(rays.rays.size());
+        int index = static_cast<int>(std::floor(turns + 0.5f)) % count;
+        return rays.rays[index < 0 ? index + count : index];
+    }
+
+    // Whether a world point has an unobstructed line to a light this frame
+    bool canSee(int light, Point p) const
+    {
+        const LightRays &rays = lights[light];
+        float dx = p.x - rays.origin.x, dy = p.y - rays.origin.y;
+        return std::hypot(dx, dy) <= rayToward(light, std::atan2(dy, dx)).distance;
+    }
+
+    // Walls hit by at least one ray of a light, as Scene::getWalls() indices
+    std::vector<int> wallsSeenBy(int light) const
+    {
+        std::vector<int> seen;
+        for (const RayRecord &ray : lights[light].rays)
+        {
+            if (ray.segment >= 0)
+                seen.push_back(ray.segment);
+        }
+        std::sort(seen.begin(), seen.end());
+        seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+        return seen;
+    }
+};
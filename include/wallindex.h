@@ -0,0 +1,583 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "constants.h"
+#include "geometry.h"
+#include "scene.h"
+#include "threadpool.h"
+
+// Acceleration structures over a scene's walls, built in parallel on the
+// pool when a map is loaded: a uniform grid of per-cell wall lists and a
+// linear BVH over the walls in Morton order. Both are built from 64-bit
+// keys holding a sort code in the high half and a wall index in the low
+// half, ordered by one stable parallel radix sort.
+
+// Stable sort of keys by bits [firstBit, lastBit) on the pool: an LSD radix
+// sort, 8 bits per pass, where blocks of keys are counted in parallel,
+// their digit offsets summed in block order and then scattered in parallel
+inline void parallelRadixSort(std::vector<uint64_t> &keys, int firstBit, int lastBit, ThreadPool &pool)
+{
+    const size_t count = keys.size();
+    const int blocks = static_cast<int>((count + SORT_BLOCK_KEYS - 1) / SORT_BLOCK_KEYS);
+    std::vector<uint64_t> sorted(count);
+    std::vector<size_t> offsets(static_cast<size_t>(blocks) * 256);
+    for (int shift = firstBit; shift < lastBit; shift += 8)
+    {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        pool.parallelFor(blocks, [&](int block, int)
+        {
+            size_t *histogram = &offsets[static_cast<size_t>(block) * 256];
+            const size_t end = std::min(count, static_cast<size_t>(block + 1) * SORT_BLOCK_KEYS);
+            for (size_t i = static_cast<size_t>(block) * SORT_BLOCK_KEYS; i < end; ++i)
+                ++histogram[(keys[i] >> shift) & 0xFF];
+        });
+
+        // Skip passes where every key has the same digit
+        bool uniform = false;
+        for (int digit = 0; digit < 256 && blocks > 0; ++digit)
+        {
+            size_t total = 0;
+            for (int block = 0; block < blocks; ++block)
+                total += offsets[static_cast<size_t>(block) * 256 + digit];
+            uniform |= total == count;
+        }
+        if (uniform)
+            continue;
+
+        size_t running = 0;
+        for (int digit = 0; digit < 256; ++digit)
+        {
+            for (int block = 0; block < blocks; ++block)
+            {
+                size_t &offset = offsets[static_cast<size_t>(block) * 256 + digit];
+                size_t blockCount = offset;
+                offset = running;
+                running += blockCount;
+            }
+        }
+
+        pool.parallelFor(blocks, [&](int block, int)
+        {
+            size_t *cursor = &offsets[static_cast<size_t>(block) * 256];
+            const size_t end = std::min(count, static_cast<size_t>(block + 1) * SORT_BLOCK_KEYS);
+            for (size_t i = static_cast<size_t>(block) * SORT_BLOCK_KEYS; i < end; ++i)
+                sorted[cursor[(keys[i] >> shift) & 0xFF]++] = keys[i];
+        });
+        keys.swap(sorted);
+    }
+}
+
+// Spread the low 16 bits of v over the even bits, for Morton codes
+inline uint32_t spreadBits(uint32_t v)
+{
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FFu;
+    v = (v | (v << 4)) & 0x0F0F0F0Fu;
+    v = (v | (v << 2)) & 0x33333333u;
+    v = (v | (v << 1)) & 0x55555555u;
+    return v;
+}
+
+// Square cells over a box, each listing the walls passing through it.
+// Cells are binned in parallel: every wall's cells become (cell, wall) keys,
+// which the radix sort groups by cell with the walls of a cell in order.
+class WallGrid
+{
+private:
+    float cellSize;
+    float inverseCellSize;
+    Point corner; // world position of the grid's minimum corner
+    int columns, rows;
+    std::vector<int> cellStart; // cell c lists cellWalls[cellStart[c]] up to cellWalls[cellStart[c + 1]]
+    std::vector<int> cellWalls; // indices into the binned wall array
+
+public:
+    WallGrid() : cellSize(1.0f), inverseCellSize(1.0f), corner({0.0f, 0.0f}), columns(0), rows(0) {}
+
+    // Bin walls, all lying within box, into cells of about cell world units,
+    // doubled until the grid fits in GRID_MAX_CELLS. The grid has one empty
+    // cell of margin on every side.
+    void build(const std::vector<Segment> &walls, const Rect &box, float cell, ThreadPool &pool)
+    {
+        cellSize = cell;
+        auto cellsAcross = [this](float extent) { return static_cast<int>(std::ceil(extent / cellSize)) + 2; };
+        while (static_cast<double>(cellsAcross(box.maxX - box.minX)) * cellsAcross(box.maxY - box.minY) > GRID_MAX_CELLS)
+            cellSize *= 2.0f;
+        inverseCellSize = 1.0f / cellSize;
+        corner = {box.minX - cellSize, box.minY - cellSize};
+        columns = cellsAcross(box.maxX - box.minX);
+        rows = cellsAcross(box.maxY - box.minY);
+        const size_t cellCount = static_cast<size_t>(columns) * rows;
+
+        // Each wall's first key, from its cell count
+        const int wallCount = static_cast<int>(walls.size());
+        const int blocks = (wallCount + SORT_BLOCK_KEYS - 1) / SORT_BLOCK_KEYS;
+        std::vector<size_t> firstKey(walls.size() + 1, 0);
+        pool.parallelFor(blocks, [&](int block, int)
+        {
+            const int end = std::min(wallCount, (block + 1) * SORT_BLOCK_KEYS);
+            for (int i = block * SORT_BLOCK_KEYS; i < end; ++i)
+                forEachCell(walls[i], [&](int) { ++firstKey[i + 1]; });
+        });
+        for (size_t i = 1; i <= walls.size(); ++i)
+            firstKey[i] += firstKey[i - 1];
+
+        std::vector<uint64_t> keys(firstKey.back());
+        pool.parallelFor(blocks, [&](int block, int)
+        {
+            const int end = std::min(wallCount, (block + 1) * SORT_BLOCK_KEYS);
+            for (int i = block * SORT_BLOCK_KEYS; i < end; ++i)
+            {
+                size_t key = firstKey[i];
+                forEachCell(walls[i], [&](int c) { keys[key++] = (static_cast<uint64_t>(c) << 32) | static_cast<uint32_t>(i); });
+            }
+        });
+        int cellBits = 0;
+        while ((static_cast<size_t>(1) << cellBits) < cellCount)
+            ++cellBits;
+        parallelRadixSort(keys, 32, 32 + cellBits, pool);
+
+        // Every cell's start is the first key at or past it, written by the
+        // key that crosses into it
+        const size_t keyCount = keys.size();
+        cellWalls.resize(keyCount);
+        cellStart.resize(cellCount + 1);
+        const int keyBlocks = static_cast<int>((keyCount + SORT_BLOCK_KEYS - 1) / SORT_BLOCK_KEYS);
+        pool.parallelFor(keyBlocks, [&](int block, int)
+        {
+            const size_t end = std::min(keyCount, static_cast<size_t>(block + 1) * SORT_BLOCK_KEYS);
+            for (size_t k = static_cast<size_t>(block) * SORT_BLOCK_KEYS; k < end; ++k)
+            {
+                cellWalls[k] = static_cast<int>(keys[k] & 0xFFFFFFFFu);
+                const size_t c = static_cast<size_t>(keys[k] >> 32);
+                for (size_t before = k == 0 ? 0 : static_cast<size_t>(keys[k - 1] >> 32) + 1; before <= c; ++before)
+                    cellStart[before] = static_cast<int>(k);
+            }
+        });
+        const size_t lastCell = keyCount == 0 ? 0 : static_cast<size_t>(keys.back() >> 32) + 1;
+        for (size_t c = lastCell; c <= cellCount; ++c)
+            cellStart[c] = static_cast<int>(keyCount);
+    }
+
+    float getCellSize() const { return cellSize; }
+    Point getCorner() const { return corner; }
+    int getColumns() const { return columns; }
+    int getRows() const { return rows; }
+    size_t getCellCount() const { return static_cast<size_t>(columns) * rows; }
+
+    // Wall entries over all cells; walls crossing several cells count once per cell
+    size_t getListedCount() const { return cellWalls.size(); }
+    const std::vector<int> &getCellStarts() const { return cellStart; }
+    const std::vector<int> &getCellWalls() const { return cellWalls; }
+
+    // Take over a grid saved from the accessors above, if it is consistent
+    // and lists only walls below wallCount; false leaves the grid as it was
+    bool restore(float cell, Point origin, int columnCount, int rowCount, const int *starts, const int *listed,
+                 size_t listedCount, int wallCount)
+    {
+        if (!(cell > 0.0f && cell < std::numeric_limits<float>::infinity()) || !std::isfinite(origin.x) ||
+            !std::isfinite(origin.y) || columnCount <= 0 || rowCount <= 0 ||
+            static_cast<double>(columnCount) * rowCount > GRID_MAX_CELLS)
+            return false;
+        const size_t cellCount = static_cast<size_t>(columnCount) * rowCount;
+        if (starts[0] != 0 || static_cast<size_t>(starts[cellCount]) != listedCount)
+            return false;
+        for (size_t c = 0; c < cellCount; ++c)
+        {
+            if (starts[c + 1] < starts[c])
+                return false;
+        }
+        for (size_t i = 0; i < listedCount; ++i)
+        {
+            if (listed[i] < 0 || listed[i] >= wallCount)
+                return false;
+        }
+
+        cellSize = cell;
+        inverseCellSize = 1.0f / cell;
+        corner = origin;
+        columns = columnCount;
+        rows = rowCount;
+        cellStart.assign(starts, starts + cellCount + 1);
+        cellWalls.assign(listed, listed + listedCount);
+        return true;
+    }
+
+    // Cell column and row of a coordinate, clamped to the grid; clamping
+    // first lets truncation stand in for floor, which is a call without SSE4.1
+    int columnOf(float x) const
+    {
+        return static_cast<int>(std::min(std::max((x - corner.x) * inverseCellSize, 0.0f), static_cast<float>(columns - 1)));
+    }
+
+    int rowOf(float y) const
+    {
+        return static_cast<int>(std::min(std::max((y - corner.y) * inverseCellSize, 0.0f), static_cast<float>(rows - 1)));
+    }
+
+    // The walls listed in a cell, as [begin, end)
+    const int *cellBegin(int cell) const { return cellWalls.data() + cellStart[cell]; }
+    const int *cellEnd(int cell) const { return cellWalls.data() + cellStart[cell + 1]; }
+    bool isOccupied(int cell) const { return cellStart[cell + 1] > cellStart[cell]; }
+
+    // Call visit(cell) for every cell the wall passes through: row by row,
+    // over the columns its stretch within the row spans, padded so rounding
+    // never drops a cell it only grazes
+    template <typename Visit>
+    void forEachCell(const Segment &wall, Visit visit) const
+    {
+        const float pad = GRID_CELL_PAD * cellSize;
+        const float minY = std::min(wall.y1, wall.y2), maxY = std::max(wall.y1, wall.y2);
+        const float dx = wall.x2 - wall.x1, dy = wall.y2 - wall.y1;
+        const float inverseDy = dy != 0.0f ? 1.0f / dy : 0.0f;
+        const int lastRow = rowOf(maxY + pad);
+        for (int row = rowOf(minY - pad); row <= lastRow; ++row)
+        {
+            // Fractions along the wall where it enters and leaves the row
+            float enter = 0.0f, leave = 1.0f;
+            if (dy != 0.0f)
+            {
+                float top = std::min(std::max(corner.y + row * cellSize, minY), maxY);
+                float bottom = std::min(std::max(corner.y + (row + 1) * cellSize, minY), maxY);
+                enter = (top - wall.y1) * inverseDy;
+                leave = (bottom - wall.y1) * inverseDy;
+            }
+            float xa = wall.x1 + enter * dx, xb = wall.x1 + leave * dx;
+            const int last = columnOf(std::max(xa, xb) + pad);
+            for (int column = columnOf(std::min(xa, xb) - pad); column <= last; ++column)
+                visit(row * columns + column);
+        }
+    }
+
+    // Call visit(wall) for the walls listed in the cells meeting box; a wall
+    // crossing several of them is visited once per cell
+    template <typename Visit>
+    void query(const Rect &box, Visit visit) const
+    {
+        if (columns == 0 || box.maxX < corner.x || box.maxY < corner.y || box.minX > corner.x + columns * cellSize ||
+            box.minY > corner.y + rows * cellSize)
+            return;
+        for (int row = rowOf(box.minY); row <= rowOf(box.maxY); ++row)
+        {
+            for (int column = columnOf(box.minX); column <= columnOf(box.maxX); ++column)
+            {
+                const int cell = row * columns + column;
+                for (const int *wall = cellBegin(cell); wall != cellEnd(cell); ++wall)
+                    visit(*wall);
+            }
+        }
+    }
+};
+
+// Linear BVH (Karras 2012) over walls sorted by the Morton code of their
+// midpoints. Every internal node is built independently from the sorted
+// codes, and bounds are then merged bottom-up, the second child to finish
+// merging its parent.
+class WallBVH
+{
+public:
+    // Children are internal node indices, or ~leaf for leaves
+    struct Node
+    {
+        Rect bounds;
+        int left, right;
+    };
+
+private:
+    std::vector<Node> nodes;       // internal nodes, the root first
+    std::vector<Rect> leafBounds;  // per leaf, in Morton order
+    std::vector<int> leafWalls;    // wall index of each leaf
+
+    // Length of the common prefix of two sorted keys, -1 past either end
+    static int commonPrefix(const std::vector<uint64_t> &keys, int i, int j)
+    {
+        if (j < 0 || j >= static_cast<int>(keys.size()))
+            return -1;
+        return __builtin_clzll(keys[i] ^ keys[j]);
+    }
+
+public:
+    // Build over walls from the sorted Morton keys, each (code << 32 | wall)
+    void build(const std::vector<Segment> &walls, const std::vector<uint64_t> &keys, ThreadPool &pool)
+    {
+        const int count = static_cast<int>(keys.size());
+        leafBounds.resize(count);
+        leafWalls.resize(count);
+        nodes.assign(std::max(count - 1, 0), Node());
+        std::vector<int> parents(static_cast<size_t>(std::max(count - 1, 0)) + count, -1); // internal nodes, then leaves
+        const int blocks = (count + SORT_BLOCK_KEYS - 1) / SORT_BLOCK_KEYS;
+
+        pool.parallelFor(blocks, [&](int block, int)
+        {
+            const int end = std::min(count, (block + 1) * SORT_BLOCK_KEYS);
+            // Gathered in a loop of their own so the cache misses overlap
+            for (int i = block * SORT_BLOCK_KEYS; i < end; ++i)
+            {
+                leafWalls[i] = static_cast<int>(keys[i] & 0xFFFFFFFFu);
+                leafBounds[i] = walls[leafWalls[i]].bounds();
+            }
+            for (int i = block * SORT_BLOCK_KEYS; i < std::min(end, count - 1); ++i)
+            {
+
+                // The range of keys under node i runs from i in direction d
+                // as far as they share more than the prefix with i's other side
+                const int d = commonPrefix(keys, i, i + 1) > commonPrefix(keys, i, i - 1) ? 1 : -1;
+                const int outside = commonPrefix(keys, i, i - d);
+                int reach = 2;
+                while (commonPrefix(keys, i, i + reach * d) > outside)
+                    reach *= 2;
+                int length = 0;
+                for (int step = reach / 2; step >= 1; step /= 2)
+                {
+                    if (commonPrefix(keys, i, i + (length + step) * d) > outside)
+                        length += step;
+                }
+                const int j = i + length * d;
+
+                // Split where the keys stop sharing the range's prefix
+                const int shared = commonPrefix(keys, i, j);
+                int split = 0, step = length;
+                do
+                {
+                    step = (step + 1) / 2;
+                    if (commonPrefix(keys, i, i + (split + step) * d) > shared)
+                        split += step;
+                } while (step > 1);
+                const int gamma = i + split * d + std::min(d, 0);
+
+                Node &node = nodes[i];
+                node.left = std::min(i, j) == gamma ? ~gamma : gamma;
+                node.right = std::max(i, j) == gamma + 1 ? ~(gamma + 1) : gamma + 1;
+                parents[node.left < 0 ? count - 1 + ~node.left : node.left] = i;
+                parents[node.right < 0 ? count - 1 + ~node.right : node.right] = i;
+            }
+        });
+
+        // Walk up from every leaf; the first child to reach a node stops there
+        std::vector<std::atomic<int>> arrivals(nodes.size());
+        for (std::atomic<int> &arrived : arrivals)
+            arrived.store(0, std::memory_order_relaxed);
+        pool.parallelFor(blocks, [&](int block, int)
+        {
+            const int end = std::min(count, (block + 1) * SORT_BLOCK_KEYS);
+            for (int leaf = block * SORT_BLOCK_KEYS; leaf < end; ++leaf)
+            {
+                for (int node = parents[count - 1 + leaf]; node >= 0; node = parents[node])
+                {
+                    if (arrivals[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+                        break;
+                    const Node &current = nodes[node];
+                    const Rect &a = current.left < 0 ? leafBounds[~current.left] : nodes[current.left].bounds;
+                    const Rect &b = current.right < 0 ? leafBounds[~current.right] : nodes[current.right].bounds;
+                    nodes[node].bounds = {std::min(a.minX, b.minX), std::min(a.minY, b.minY),
+                                          std::max(a.maxX, b.maxX), std::max(a.maxY, b.maxY)};
+                }
+            }
+        });
+    }
+
+    size_t getNodeCount() const { return nodes.size() + leafWalls.size(); }
+    const std::vector<Node> &getNodes() const { return nodes; }
+    const std::vector<Rect> &getLeafBounds() const { return leafBounds; }
+    const std::vector<int> &getLeafWalls() const { return leafWalls; }
+
+    // Take over a hierarchy saved from the accessors above, with a leaf per
+    // wall. It must be a tree, every node but the root having one parent,
+    // no deeper than query's stack allows; false leaves the BVH as it was.
+    bool restore(const Node *savedNodes, const Rect *savedBounds, const int *savedWalls, int wallCount)
+    {
+        const int nodeCount = std::max(wallCount - 1, 0);
+        std::vector<int> parents(static_cast<size_t>(nodeCount) + wallCount, -1); // internal nodes, then leaves
+        for (int i = 0; i < nodeCount; ++i)
+        {
+            for (int child : {savedNodes[i].left, savedNodes[i].right})
+            {
+                const int slot = child < 0 ? nodeCount + ~child : child;
+                if (child == 0 || (child > 0 && child >= nodeCount) || (child < 0 && ~child >= wallCount) ||
+                    parents[slot] >= 0)
+                    return false;
+                parents[slot] = i;
+            }
+        }
+        for (int i = 0; i < wallCount; ++i)
+        {
+            if (savedWalls[i] < 0 || savedWalls[i] >= wallCount)
+                return false;
+        }
+
+        // With one parent each, a walk up from any slot ends at the root (slot
+        // 0, internal node 0 or the only leaf) unless it is caught in a cycle,
+        // which the depth limit stops
+        std::vector<int> depths(parents.size(), -1);
+        if (!depths.empty())
+            depths[0] = 0;
+        for (size_t start = 0; start < parents.size(); ++start)
+        {
+            int length = 0, node = static_cast<int>(start);
+            while (depths[node] < 0 && length <= 64)
+            {
+                if (parents[node] < 0)
+                    return false;
+                node = parents[node];
+                ++length;
+            }
+            if (length > 64 || depths[node] + length > 64)
+                return false;
+            int depth = depths[node] + length;
+            for (int below = static_cast<int>(start); below != node; below = parents[below])
+                depths[below] = depth--;
+        }
+
+        nodes.assign(savedNodes, savedNodes + nodeCount);
+        leafBounds.assign(savedBounds, savedBounds + wallCount);
+        leafWalls.assign(savedWalls, savedWalls + wallCount);
+        return true;
+    }
+
+    // Call visit(wall) once for every wall whose bounds meet box
+    template <typename Visit>
+    void query(const Rect &box, Visit visit) const
+    {
+        if (leafWalls.empty())
+            return;
+        int stack[128]; // a node's depth is at most the 64 key bits
+        int depth = 0;
+        stack[depth++] = nodes.empty() ? ~0 : 0;
+        while (depth > 0)
+        {
+            const int node = stack[--depth];
+            if (node < 0)
+            {
+                if (leafBounds[~node].intersects(box))
+                    visit(leafWalls[~node]);
+            }
+            else if (nodes[node].bounds.intersects(box))
+            {
+                stack[depth++] = nodes[node].left;
+                stack[depth++] = nodes[node].right;
+            }
+        }
+    }
+};
+
+// The grid and LBVH of one version of a scene, with the time each build
+// stage took
+class WallIndex
+{
+public:
+    struct BuildTimes
+    {
+        double mortonMs = 0.0; // midpoint bounds and Morton keys
+        double sortMs = 0.0;   // radix sort of the Morton keys
+        double bvhMs = 0.0;    // hierarchy and bounds
+        double gridMs = 0.0;   // binning and its sort
+    };
+
+private:
+    const Scene *scene;
+    unsigned int sceneVersion;
+    WallGrid grid;
+    WallBVH bvh;
+    BuildTimes times;
+
+public:
+    WallIndex() : scene(nullptr), sceneVersion(0) {}
+
+    bool isBuiltFor(const Scene &target) const { return scene == &target && sceneVersion == target.getVersion(); }
+
+    // Build both structures for the scene's current walls. The grid cell is
+    // sized for about WALLS_PER_GRID_CELL walls per cell on average.
+    void build(const Scene &target, ThreadPool &pool)
+    {
+        typedef std::chrono::steady_clock Clock;
+        auto millisecondsSince = [](Clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        };
+        scene = &target;
+        sceneVersion = target.getVersion();
+        const std::vector<Segment> &walls = target.getWalls();
+        const int count = static_cast<int>(walls.size());
+        const int blocks = (count + SORT_BLOCK_KEYS - 1) / SORT_BLOCK_KEYS;
+
+        // Bounds of the wall midpoints and of the walls, reduced per block
+        Clock::time_point start = Clock::now();
+        const float infinity = std::numeric_limits<float>::infinity();
+        std::vector<Rect> midBlocks(blocks, Rect{infinity, infinity, -infinity, -infinity});
+        std::vector<Rect> wallBlocks(midBlocks);
+        pool.parallelFor(blocks, [&](int block, int)
+        {
+            Rect &mid = midBlocks[block], &box = wallBlocks[block];
+            const int end = std::min(count, (block + 1) * SORT_BLOCK_KEYS);
+            for (int i = block * SORT_BLOCK_KEYS; i < end; ++i)
+            {
+                const Segment &wall = walls[i];
+                const float x = (wall.x1 + wall.x2) * 0.5f, y = (wall.y1 + wall.y2) * 0.5f;
+                mid = {std::min(mid.minX, x), std::min(mid.minY, y), std::max(mid.maxX, x), std::max(mid.maxY, y)};
+                const Rect wallBox = wall.bounds();
+                box = {std::min(box.minX, wallBox.minX), std::min(box.minY, wallBox.minY),
+                       std::max(box.maxX, wallBox.maxX), std::max(box.maxY, wallBox.maxY)};
+            }
+        });
+        Rect mids = {0.0f, 0.0f, 0.0f, 0.0f}, box = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int block = 0; block < blocks; ++block)
+        {
+            const Rect &m = midBlocks[block], &b = wallBlocks[block];
+            mids = block == 0 ? m : Rect{std::min(mids.minX, m.minX), std::min(mids.minY, m.minY),
+                                         std::max(mids.maxX, m.maxX), std::max(mids.maxY, m.maxY)};
+            box = block == 0 ? b : Rect{std::min(box.minX, b.minX), std::min(box.minY, b.minY),
+                                        std::max(box.maxX, b.maxX), std::max(box.maxY, b.maxY)};
+        }
+
+        // 16 bits per axis over the midpoint bounds
+        const float scaleX = mids.maxX > mids.minX ? 65535.0f / (mids.maxX - mids.minX) : 0.0f;
+        const float scaleY = mids.maxY > mids.minY ? 65535.0f / (mids.maxY - mids.minY) : 0.0f;
+        std::vector<uint64_t> keys(walls.size());
+        pool.parallelFor(blocks, [&](int block, int)
+        {
+            const int end = std::min(count, (block + 1) * SORT_BLOCK_KEYS);
+            for (int i = block * SORT_BLOCK_KEYS; i < end; ++i)
+            {
+                const Segment &wall = walls[i];
+                const uint32_t x = static_cast<uint32_t>(((wall.x1 + wall.x2) * 0.5f - mids.minX) * scaleX);
+                const uint32_t y = static_cast<uint32_t>(((wall.y1 + wall.y2) * 0.5f - mids.minY) * scaleY);
+                keys[i] = (static_cast<uint64_t>(spreadBits(x) | (spreadBits(y) << 1)) << 32) | static_cast<uint32_t>(i);
+            }
+        });
+        times.mortonMs = millisecondsSince(start);
+
+        start = Clock::now();
+        parallelRadixSort(keys, 32, 64, pool);
+        times.sortMs = millisecondsSince(start);
+
+        start = Clock::now();
+        bvh.build(walls, keys, pool);
+        times.bvhMs = millisecondsSince(start);
+
+        start = Clock::now();
+        const float area = std::max((box.maxX - box.minX) * (box.maxY - box.minY), 1.0f);
+        grid.build(walls, box, std::sqrt(area * WALLS_PER_GRID_CELL / std::max(count, 1)), pool);
+        times.gridMs = millisecondsSince(start);
+    }
+
+    // Take over a grid and BVH restored for target's current walls, as
+    // IndexCache does, in place of a build
+    void adopt(const Scene &target, WallGrid &&restoredGrid, WallBVH &&restoredBVH)
+    {
+        scene = &target;
+        sceneVersion = target.getVersion();
+        grid = std::move(restoredGrid);
+        bvh = std::move(restoredBVH);
+        times = BuildTimes();
+    }
+
+    const WallGrid &getGrid() const { return grid; }
+    const WallBVH &getBVH() const { return bvh; }
+    const BuildTimes &getBuildTimes() const { return times; }
+};
@@ -0,0 +1,532 @@
+#pragma once
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "arena.h"
+#include "scene.h"
+
+// On-disk layout of a chunked world file: a header, a tilesX * tilesY index
+// of WorldTileEntry, then each tile's segments as packed x1 y1 x2 y2 floats.
+// Segments belong to the tile containing their midpoint; a tile's bounds
+// cover all of its segments, so they may extend past the grid cell.
+struct WorldFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    float originX, originY;
+    float tileSize;
+    int32_t tilesX, tilesY;
+    uint32_t padding;
+    uint64_t segmentCount;
+};
+
+struct WorldTileEntry
+{
+    uint64_t offset;
+    uint64_t count;
+    Rect bounds;
+};
+
+// Writes a scene's walls as a chunked world file for StreamingWorld
+class WorldFileWriter
+{
+public:
+    static bool write(const std::string &path, const std::vector<Segment> &walls, float tileSize)
+    {
+        if (walls.empty() || tileSize <= 0.0f)
+        {
+            std::cerr << "Nothing to write to " << path << std::endl;
+            return false;
+        }
+
+        Rect box = {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(),
+                    -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()};
+        for (const Segment &wall : walls)
+        {
+            Rect wallBox = wall.bounds();
+            box = {std::min(box.minX, wallBox.minX), std::min(box.minY, wallBox.minY),
+                   std::max(box.maxX, wallBox.maxX), std::max(box.maxY, wallBox.maxY)};
+        }
+
+        WorldFileHeader header = {};
+        std::memcpy(header.magic, WORLD_FILE_MAGIC, sizeof(header.magic));
+        header.version = WORLD_FILE_VERSION;
+        header.originX = box.minX;
+        header.originY = box.minY;
+        header.tileSize = tileSize;
+        header.tilesX = std::max(1, static_cast<int>(std::ceil((box.maxX - box.minX) / tileSize)));
+        header.tilesY = std::max(1, static_cast<int>(std::ceil((box.maxY - box.minY) / tileSize)));
+        header.segmentCount = walls.size();
+
+        // Bucket the segments by tile with a counting sort
+        const size_t tileCount = static_cast<size_t>(header.tilesX) * header.tilesY;
+        std::vector<uint32_t> tileOf(walls.size());
+        std::vector<uint64_t> counts(tileCount + 1, 0);
+        for (size_t i = 0; i < walls.size(); ++i)
+        {
+            int tx = static_cast<int>(((walls[i].x1 + walls[i].x2) * 0.5f - header.originX) / tileSize);
+            int ty = static_cast<int>(((walls[i].y1 + walls[i].y2) * 0.5f - header.originY) / tileSize);
+            tx = std::max(0, std::min(header.tilesX - 1, tx));
+            ty = std::max(0, std::min(header.tilesY - 1, ty));
+            tileOf[i] = static_cast<uint32_t>(ty * header.tilesX + tx);
+            ++counts[tileOf[i] + 1];
+        }
+        for (size_t t = 0; t < tileCount; ++t)
+            counts[t + 1] += counts[t];
+
+        std::vector<float> data(walls.size() * 4);
+        std::vector<uint64_t> cursor(counts.begin(), counts.end() - 1);
+        std::vector<WorldTileEntry> index(tileCount);
+        for (size_t t = 0; t < tileCount; ++t)
+        {
+            int tx = static_cast<int>(t % header.tilesX), ty = static_cast<int>(t / header.tilesX);
+            float minX = header.originX + tx * tileSize, minY = header.originY + ty * tileSize;
+            index[t].bounds = {minX, minY, minX + tileSize, minY + tileSize};
+        }
+        for (size_t i = 0; i < walls.size(); ++i)
+        {
+            WorldTileEntry &entry = index[tileOf[i]];
+            Rect wallBox = walls[i].bounds();
+            entry.bounds = {std::min(entry.bounds.minX, wallBox.minX), std::min(entry.bounds.minY, wallBox.minY),
+                            std::max(entry.bounds.maxX, wallBox.maxX), std::max(entry.bounds.maxY, wallBox.maxY)};
+            float *out = &data[cursor[tileOf[i]]++ * 4];
+            out[0] = walls[i].x1;
+            out[1] = walls[i].y1;
+            out[2] = walls[i].x2;
+            out[3] = walls[i].y2;
+        }
+
+        const uint64_t dataStart = sizeof(WorldFileHeader) + tileCount * sizeof(WorldTileEntry);
+        for (size_t t = 0; t < tileCount; ++t)
+        {
+            index[t].offset = dataStart + counts[t] * 4 * sizeof(float);
+            index[t].count = counts[t + 1] - counts[t];
+        }
+
+        FILE *file = std::fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            std::cerr << "Could not open " << path << " for writing" << std::endl;
+            return false;
+        }
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  std::fwrite(index.data(), sizeof(WorldTileEntry), tileCount, file) == tileCount &&
+                  std::fwrite(data.data(), sizeof(float), data.size(), file) == data.size();
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok)
+            std::cerr << "Failed writing " << path << std::endl;
+        return ok;
+    }
+};
+
+// Seek to a 64-bit file offset; fseek takes a long, which is 32 bits on
+// LLP64 targets
+inline bool seekTo(FILE *file, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+    return fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+// Pages tiles of a chunked world file in and out of a Scene around the
+// camera and light. Reads happen on a background I/O thread; the render
+// thread only swaps finished tiles in, evicting least recently needed
+// tiles to stay within the memory budget. A tile's walls are held once:
+// by the tile until the scene takes them in, then only by the scene.
+class StreamingWorld
+{
+private:
+    enum TileState : uint8_t
+    {
+        TILE_UNLOADED,
+        TILE_QUEUED,
+        TILE_RESIDENT
+    };
+
+    struct LoadedTile
+    {
+        int tile;
+        std::vector<Segment> segments;
+    };
+
+    struct SceneSpan
+    {
+        size_t start, count; // the tile's walls in the scene
+    };
+
+    WorldFileHeader header;
+    std::vector<WorldTileEntry> index;
+    int searchMargin; // cells the widest tile overhangs its grid cell by, rounded up
+    std::vector<TileState> states;
+    std::vector<uint64_t> lastNeeded; // frame in which each tile was last needed
+    std::vector<std::vector<Segment>> arrivedTiles; // loaded walls the scene has not taken in yet
+    std::vector<bool> inScene;                      // whether the scene's walls include each tile's
+    std::vector<SceneSpan> sceneSpans;
+    std::vector<int> lruPrev, lruNext; // resident tiles, least recently needed or loaded first
+    int lruHead, lruTail;
+    size_t budgetBytes;
+    size_t residentBytes; // walls of resident tiles, in the scene or arrived
+    size_t staleBytes;    // walls of evicted tiles the scene still holds
+    size_t queuedBytes;
+    uint64_t frame;
+    bool overBudgetReported;
+
+    FILE *file;
+    std::thread ioThread;
+    std::mutex mutex;
+    std::condition_variable wake;   // signals the I/O thread
+    std::condition_variable loaded; // signals a finished load
+    std::deque<int> requests;       // needed tiles at the front, prefetch at the back
+    std::vector<bool> prefetchQueued; // tiles waiting in the back of requests
+    std::vector<LoadedTile> completed;
+    bool stopping;
+
+    size_t tileBytes(int tile) const
+    {
+        return static_cast<size_t>(index[tile].count) * sizeof(Segment);
+    }
+
+    void ioLoop()
+    {
+        std::vector<float> buffer;
+        while (true)
+        {
+            int tile;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+                if (stopping)
+                    return;
+                tile = requests.front();
+                requests.pop_front();
+                prefetchQueued[tile] = false;
+            }
+
+            LoadedTile result = {tile, {}};
+            const WorldTileEntry &entry = index[tile];
+            buffer.resize(static_cast<size_t>(entry.count) * 4);
+            if (seekTo(file, entry.offset) &&
+                std::fread(buffer.data(), sizeof(float), buffer.size(), file) == buffer.size())
+            {
+                result.segments.reserve(entry.count);
+                for (size_t i = 0; i < buffer.size(); i += 4)
+                    result.segments.push_back(Segment(buffer[i], buffer[i + 1], buffer[i + 2], buffer[i + 3]));
+            }
+            else
+            {
+                std::cerr << "Failed reading world tile " << tile << std::endl;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                completed.push_back(std::move(result));
+            }
+            loaded.notify_all();
+        }
+    }
+
+    void unlinkTile(int tile)
+    {
+        (lruPrev[tile] >= 0 ? lruNext[lruPrev[tile]] : lruHead) = lruNext[tile];
+        (lruNext[tile] >= 0 ? lruPrev[lruNext[tile]] : lruTail) = lruPrev[tile];
+    }
+
+    // Make tile the most recently used resident tile
+    void touchTile(int tile)
+    {
+        if (lruTail == tile)
+            return;
+        if (states[tile] == TILE_RESIDENT)
+            unlinkTile(tile);
+        lruPrev[tile] = lruTail;
+        lruNext[tile] = -1;
+        (lruTail >= 0 ? lruNext[lruTail] : lruHead) = tile;
+        lruTail = tile;
+    }
+
+    // Tiles whose bounds meet the region, via the grid cells it covers
+    template <typename Visit>
+    void forTilesIn(const Rect &region, Visit visit) const
+    {
+        // Tile bounds can overhang their cell, so widen the cell search by as much
+        int x0 = static_cast<int>(std::floor((region.minX - header.originX) / header.tileSize)) - searchMargin;
+        int y0 = static_cast<int>(std::floor((region.minY - header.originY) / header.tileSize)) - searchMargin;
+        int x1 = static_cast<int>(std::floor((region.maxX - header.originX) / header.tileSize)) + searchMargin;
+        int y1 = static_cast<int>(std::floor((region.maxY - header.originY) / header.tileSize)) + searchMargin;
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+        x1 = std::min(x1, header.tilesX - 1);
+        y1 = std::min(y1, header.tilesY - 1);
+        for (int ty = y0; ty <= y1; ++ty)
+        {
+            for (int tx = x0; tx <= x1; ++tx)
+            {
+                int tile = ty * header.tilesX + tx;
+                if (index[tile].count > 0 && index[tile].bounds.intersects(region))
+                    visit(tile);
+            }
+        }
+    }
+
+public:
+    StreamingWorld() : header(), searchMargin(1), lruHead(-1), lruTail(-1), budgetBytes(0), residentBytes(0),
+                       staleBytes(0), queuedBytes(0), frame(0), overBudgetReported(false), file(nullptr), stopping(false) {}
+
+    ~StreamingWorld()
+    {
+        if (ioThread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            ioThread.join();
+        }
+        if (file)
+        {
+            std::fclose(file);
+        }
+    }
+
+    bool open(const std::string &path, size_t memoryBudgetBytes)
+    {
+        file = std::fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            std::cerr << "Could not open world file " << path << std::endl;
+            return false;
+        }
+        if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+            std::memcmp(header.magic, WORLD_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != WORLD_FILE_VERSION || header.tilesX <= 0 || header.tilesY <= 0 ||
+            header.tileSize <= 0.0f)
+        {
+            std::cerr << path << " is not a version " << WORLD_FILE_VERSION << " world file" << std::endl;
+            return false;
+        }
+
+        const size_t tileCount = static_cast<size_t>(header.tilesX) * header.tilesY;
+        index.resize(tileCount);
+        if (std::fread(index.data(), sizeof(WorldTileEntry), tileCount, file) != tileCount)
+        {
+            std::cerr << "Truncated tile index in " << path << std::endl;
+            return false;
+        }
+
+        // Walls belong to the tile holding their midpoint, so a long one can
+        // reach several cells past it
+        float overhang = 0.0f;
+        for (size_t t = 0; t < tileCount; ++t)
+        {
+            if (index[t].count == 0)
+                continue;
+            const float minX = header.originX + static_cast<int>(t % header.tilesX) * header.tileSize;
+            const float minY = header.originY + static_cast<int>(t / header.tilesX) * header.tileSize;
+            const Rect &bounds = index[t].bounds;
+            overhang = std::max({overhang, minX - bounds.minX, minY - bounds.minY, bounds.maxX - (minX + header.tileSize),
+                                 bounds.maxY - (minY + header.tileSize)});
+        }
+        const float gridCells = static_cast<float>(std::max(header.tilesX, header.tilesY));
+        searchMargin = static_cast<int>(std::max(1.0f, std::min(std::ceil(overhang / header.tileSize), gridCells)));
+
+        states.assign(tileCount, TILE_UNLOADED);
+        lastNeeded.assign(tileCount, 0);
+        arrivedTiles.resize(tileCount);
+        inScene.assign(tileCount, false);
+        prefetchQueued.assign(tileCount, false);
+        sceneSpans.assign(tileCount, SceneSpan{0, 0});
+        lruPrev.assign(tileCount, -1);
+        lruNext.assign(tileCount, -1);
+        budgetBytes = memoryBudgetBytes;
+        ioThread = std::thread(&StreamingWorld::ioLoop, this);
+        return true;
+    }
+
+    Rect bounds() const
+    {
+        return {header.originX, header.originY,
+                header.originX + header.tilesX * header.tileSize, header.originY + header.tilesY * header.tileSize};
+    }
+
+    // Wall bytes held, in the scene and in tiles waiting to join it
+    size_t getResidentBytes() const { return residentBytes + staleBytes; }
+
+    // Request the tiles covering `needed` plus a prefetch of the same region
+    // moved along `velocity` (world units per second), then fold finished
+    // loads into the scene. With waitForNeeded the call blocks until every
+    // needed tile is resident, for deterministic headless runs.
+    void update(Scene &scene, const Rect &needed, Point velocity, bool waitForNeeded, Arena &arena)
+    {
+        ++frame;
+        FrameVector<int> neededTiles{ArenaAllocator<int>(arena)};
+        forTilesIn(needed, [&](int tile)
+                   {
+                       lastNeeded[tile] = frame;
+                       neededTiles.push_back(tile);
+                   });
+
+        Rect ahead = {needed.minX + velocity.x * PREFETCH_SECONDS, needed.minY + velocity.y * PREFETCH_SECONDS,
+                      needed.maxX + velocity.x * PREFETCH_SECONDS, needed.maxY + velocity.y * PREFETCH_SECONDS};
+        FrameVector<int> prefetchTiles{ArenaAllocator<int>(arena)};
+        if (velocity.x != 0.0f || velocity.y != 0.0f)
+        {
+            forTilesIn(ahead, [&](int tile)
+                       {
+                           if (lastNeeded[tile] != frame)
+                               prefetchTiles.push_back(tile);
+                       });
+        }
+
+        // An evicted tile the scene still holds is taken back without a read
+        auto revive = [&](int tile)
+        {
+            if (states[tile] != TILE_UNLOADED || !inScene[tile])
+                return false;
+            staleBytes -= tileBytes(tile);
+            residentBytes += tileBytes(tile);
+            touchTile(tile);
+            states[tile] = TILE_RESIDENT;
+            return true;
+        };
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int tile : neededTiles)
+            {
+                if (prefetchQueued[tile])
+                {
+                    // Move a queued prefetch ahead of the rest of the prefetch
+                    requests.erase(std::find(requests.begin(), requests.end(), tile));
+                    requests.push_front(tile);
+                    prefetchQueued[tile] = false;
+                    continue;
+                }
+                if (states[tile] != TILE_UNLOADED || revive(tile))
+                    continue;
+                states[tile] = TILE_QUEUED;
+                queuedBytes += tileBytes(tile);
+                requests.push_front(tile);
+            }
+            for (int tile : prefetchTiles)
+            {
+                // Prefetch only what fits without evicting needed tiles
+                if (states[tile] != TILE_UNLOADED || revive(tile) ||
+                    residentBytes + staleBytes + queuedBytes + tileBytes(tile) > budgetBytes)
+                    continue;
+                states[tile] = TILE_QUEUED;
+                queuedBytes += tileBytes(tile);
+                requests.push_back(tile);
+                prefetchQueued[tile] = true;
+            }
+        }
+        wake.notify_one();
+
+        std::vector<LoadedTile> arrived;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (waitForNeeded)
+            {
+                auto pendingNeeded = [&]()
+                {
+                    for (int tile : neededTiles)
+                    {
+                        if (states[tile] != TILE_QUEUED)
+                            continue;
+                        bool done = false;
+                        for (const LoadedTile &loadedTile : completed)
+                            done = done || loadedTile.tile == tile;
+                        if (!done)
+                            return true;
+                    }
+                    return false;
+                };
+                loaded.wait(lock, [&]() { return !pendingNeeded(); });
+            }
+            arrived.swap(completed);
+        }
+
+        for (LoadedTile &tile : arrived)
+        {
+            queuedBytes -= tileBytes(tile.tile);
+            residentBytes += tileBytes(tile.tile);
+            arrivedTiles[tile.tile] = std::move(tile.segments);
+            touchTile(tile.tile);
+            states[tile.tile] = TILE_RESIDENT;
+        }
+        for (int tile : neededTiles)
+        {
+            if (states[tile] == TILE_RESIDENT)
+                touchTile(tile);
+        }
+
+        // Evict the least recently needed tiles until the resident ones fit.
+        // An evicted tile the scene holds only goes stale, its memory freed
+        // by the next rebuild.
+        while (residentBytes > budgetBytes)
+        {
+            const int victim = lruHead;
+            if (victim < 0 || lastNeeded[victim] == frame)
+            {
+                if (!overBudgetReported)
+                    std::cerr << "Visible tiles exceed the streaming budget" << std::endl;
+                overBudgetReported = true;
+                break;
+            }
+            unlinkTile(victim);
+            residentBytes -= tileBytes(victim);
+            if (inScene[victim])
+                staleBytes += tileBytes(victim);
+            std::vector<Segment>().swap(arrivedTiles[victim]);
+            states[victim] = TILE_UNLOADED;
+        }
+
+        // New walls make the wall index, distance field and wall layer
+        // rebuild, so the scene is only rebuilt once a needed tile is missing
+        // from it or stale tiles hold it over budget. It then takes in every
+        // resident tile, prefetched ones too, and drops the stale ones.
+        bool rebuild = residentBytes + staleBytes > budgetBytes && staleBytes > 0;
+        for (int tile : neededTiles)
+            rebuild |= states[tile] == TILE_RESIDENT && !inScene[tile];
+        if (rebuild)
+        {
+            // On the heap rather than the frame arena: it becomes the scene's
+            // walls. The old walls are freed once it replaces them.
+            const std::vector<Segment> &previous = scene.getWalls();
+            std::vector<Segment> walls;
+            walls.reserve(residentBytes / sizeof(Segment));
+            for (size_t t = 0; t < states.size(); ++t)
+            {
+                const bool resident = states[t] == TILE_RESIDENT;
+                if (resident && inScene[t])
+                {
+                    const SceneSpan span = sceneSpans[t];
+                    sceneSpans[t].start = walls.size();
+                    walls.insert(walls.end(), previous.begin() + span.start, previous.begin() + span.start + span.count);
+                }
+                else if (resident)
+                {
+                    sceneSpans[t] = {walls.size(), arrivedTiles[t].size()};
+                    walls.insert(walls.end(), arrivedTiles[t].begin(), arrivedTiles[t].end());
+                    std::vector<Segment>().swap(arrivedTiles[t]);
+                }
+                inScene[t] = resident;
+            }
+            scene.setWalls(std::move(walls));
+            staleBytes = 0;
+        }
+    }
+};
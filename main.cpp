@@ -3,313 +3,316 @@
 #include <vector>
 #include <cmath>
 #include <limits>
-
-// Constants
-#define SCREEN_WIDTH 800
-#define SCREEN_HEIGHT 600
-#define PI 3.14159265358979f
-#define ANGLE_STEP_DEG 0.05f
-
-// Point structure to represent positions
-struct Point
-{
-    float x, y;
-};
-
-// Segment structure to represent walls
-class Segment
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include "constants.h"
+#include "geometry.h"
+#include "arena.h"
+#include "scene.h"
+#include "renderer.h"
+#include "world.h"
+#include "capture.h"
+#include "raycaster.h"
+#include "light.h"
+#include "threadpool.h"
+#include "tiled.h"
+#include "indexcache.h"
+
+// Launch options parsed from a config file and the command line
+struct Settings
 {
-public:
-    float x1, y1, x2, y2;
-
-    Segment(float x1, float y1, float x2, float y2)
-        : x1(x1), y1(y1), x2(x2), y2(y2) {}
-};
-
-// Ray class to handle ray operations
-class Ray
-{
-public:
-    Point pos; // Starting point of the ray
-    Point dir; // Normalized direction vector
-
-    // Constructor to initialize ray position and angle
-    Ray(float x, float y, float angle)
+    int width = DEFAULT_SCREEN_WIDTH;
+    int height = DEFAULT_SCREEN_HEIGHT;
+    bool headless = false;
+    int frames = 0; // frames to render before exiting, 0 runs until quit (headless defaults to 100)
+    int roomCols = 0, roomRows = 0; // generated map size, 0 keeps the built-in scene
+    std::string bakeWorldPath;       // write the scene as a chunked world file and exit
+    std::string worldPath;           // stream a chunked world file instead of the built-in scene
+    float tileSize = DEFAULT_TILE_SIZE;
+    int streamBudgetMB = DEFAULT_STREAM_BUDGET_MB;
+    std::string capturePath;         // printf pattern for .ppm/.png sequences, or a single .rgb file
+    FrameCapture::Policy capturePolicy = FrameCapture::POLICY_DROP;
+    int capturePool = DEFAULT_CAPTURE_POOL;
+    float zoom = 1.0f;
+    std::string goldenDir;           // reference image directory for --golden-record / --golden-check
+    bool goldenRecord = false;
+    int goldenTolerance = DEFAULT_GOLDEN_TOLERANCE;
+    int goldenMaxBadPixels = DEFAULT_GOLDEN_MAX_BAD_PIXELS;
+    int goldenMaxDiff = DEFAULT_GOLDEN_MAX_DIFF;
+    bool visibilityBuffers = false; // record per-ray hits and per-pixel light masks
+    AreaLight areaLight;            // point light unless --area-light is given
+    int lightSamples = DEFAULT_LIGHT_SAMPLES;
+    bool accumulate = false; // blend area light samples over frames while nothing moves
+    bool smoothWalls = false; // anti-aliased wall lines
+    int lightCount = 0;       // static lights added to the scene, shaded in tiles
+    std::string configPath;   // key = value file read before the command line, reloaded when it changes
+    std::string scenePath;    // text scene file replacing the built-in walls
+    float falloff = FALLOFF_K; // k of the light's exp(-k * d) falloff, per world unit
+    int baseRays = static_cast<int>(360.0f / ANGLE_STEP_DEG); // fewest rays per light sweep
+    int threads = 0;          // worker threads, 0 for one per hardware thread
+    SpatialIndex index = INDEX_PORTALS;
+    float fieldCell = 0.0f;   // distance field cell size for marched point light rays, 0 searches the culled walls
+    std::string program = "SDLGame";
+    std::vector<std::string> commandLine; // as given, to parse again when the config file changes
+
+    bool parse(int argc, char *argv[])
     {
-        pos = {x, y};
-        dir = {std::cos(angle), std::sin(angle)};
+        program = argv[0];
+        return parse(std::vector<std::string>(argv + 1, argv + argc));
     }
 
-    // Cast ray against a wall and find intersection
-    Point cast(const Segment &wall) const
+    // Parse the config file named by --config, if any, then the command line
+    // over it, so options given on the command line win
+    bool parse(const std::vector<std::string> &arguments)
     {
-        float x1 = wall.x1, y1 = wall.y1;
-        float x2 = wall.x2, y2 = wall.y2;
-        float x3 = pos.x, y3 = pos.y;
-        float x4 = pos.x + dir.x, y4 = pos.y + dir.y;
-
-        // Calculate determinant
-        float den = (x1 - x2) * (y3 - y4) - (y1 - y2) * (x3 - x4);
-        if (den == 0)
-        {
-            // Parallel or collinear, no intersection
-            return {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity()};
-        }
-
-        // Solve for t and u
-        float t = ((x1 - x3) * (y3 - y4) - (y1 - y3) * (x3 - x4)) / den;
-        float u = -((x1 - x2) * (y1 - y3) - (y1 - y2) * (x1 - x3)) / den;
-
-        // Check if intersection is valid
-        if (t >= 0 && t <= 1 && u >= 0)
+        commandLine = arguments;
+        for (size_t i = 0; i + 1 < arguments.size(); ++i)
         {
-            // Calculate intersection point
-            float px = x1 + t * (x2 - x1);
-            float py = y1 + t * (y2 - y1);
-            return {px, py};
+            if (arguments[i] == "--config")
+                configPath = arguments[i + 1];
         }
-
-        // No valid intersection
-        return {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity()};
-    }
-};
-
-// Scene class to manage walls
-class Scene
-{
-private:
-    std::vector<Segment> walls;
-
-public:
-    Scene()
-    {
-        // Define the scene with walls
-        walls = {
-            Segment(400, 400, 500, 500),
-            Segment(300, 100, 300, 300),
-            Segment(500, 600, 400, 500),
-            Segment(300, 300, 100, 300),
-            Segment(100, 300, 100, 100),
-            Segment(600, 150, 600, 450), // mur vertical à droite
-            Segment(200, 450, 200, 150)  // mur vertical à gauche
-        };
-    }
-
-    const std::vector<Segment> &getWalls() const
-    {
-        return walls;
-    }
-
-    bool isPointOnSegment(int x, int y, const Segment &wall) const
-    {
-        float dx = wall.x2 - wall.x1;
-        float dy = wall.y2 - wall.y1;
-        float cross = (x - wall.x1) * dy - (y - wall.y1) * dx;
-        if (std::fabs(cross) > 0)
+        std::vector<std::string> args;
+        if (!configPath.empty() && !readConfig(configPath, args))
             return false;
+        args.insert(args.end(), arguments.begin(), arguments.end());
 
-        // Check if pt is between wall.x1,y1 and wall.x2,y2 using the bounding box method.
-        float minX = std::min(wall.x1, wall.x2);
-        float maxX = std::max(wall.x1, wall.x2);
-        float minY = std::min(wall.y1, wall.y2);
-        float maxY = std::max(wall.y1, wall.y2);
-
-        if (x < minX || x > maxX || y < minY || y > maxY)
+        for (size_t i = 0; i < args.size(); ++i)
         {
-            return false;
-        }
-
-        return true;
-    }
-};
-
-// Renderer class to handle drawing operations
-class Renderer
-{
-private:
-    SDL_Texture *texture;
-    void *pixels;
-    int pitch;
-    int pixelPerRow;
-    Uint32 *pixelBuffer;
-    SDL_Renderer *sdlRenderer;
-
-public:
-    Renderer(SDL_Renderer *renderer) : sdlRenderer(renderer), pixels(nullptr), pixelBuffer(nullptr)
-    {
-        texture = SDL_CreateTexture(
-            renderer,
-            SDL_PIXELFORMAT_ARGB8888,
-            SDL_TEXTUREACCESS_STREAMING,
-            SCREEN_WIDTH,
-            SCREEN_HEIGHT);
-        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-    }
-
-    ~Renderer()
-    {
-        if (texture)
-        {
-            SDL_DestroyTexture(texture);
-        }
-    }
-
-    void beginFrame()
-    {
-        if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) < 0)
-        {
-            std::cerr << "SDL_LockTexture Error: " << SDL_GetError() << std::endl;
-            return;
-        }
-
-        pixelPerRow = pitch / sizeof(Uint32);
-        pixelBuffer = static_cast<Uint32 *>(pixels);
-        clearTexture();
-    }
-
-    void endFrame()
-    {
-        SDL_UnlockTexture(texture);
-        SDL_RenderCopy(sdlRenderer, texture, nullptr, nullptr);
-        SDL_RenderPresent(sdlRenderer);
-    }
-
-    void clearTexture()
-    {
-        for (int y = 0; y < SCREEN_HEIGHT; ++y)
-        {
-            for (int x = 0; x < SCREEN_WIDTH; ++x)
+            const std::string &arg = args[i];
+            bool hasValue = i + 1 < args.size();
+            if (arg == "--size" && hasValue)
             {
-                pixelBuffer[y * pixelPerRow + x] = 0xFF000000;
+                if (std::sscanf(args[++i].c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+                {
+                    std::cerr << "Invalid --size, expected WIDTHxHEIGHT" << std::endl;
+                    return false;
+                }
             }
-        }
-    }
-
-    void drawLine(int x1, int y1, int x2, int y2, Uint32 color)
-    {
-        int dx = std::abs(x2 - x1);
-        int dy = std::abs(y2 - y1);
-        int sx = (x1 < x2) ? 1 : -1;
-        int sy = (y1 < y2) ? 1 : -1;
-        int err = dx - dy;
-
-        while (true)
-        {
-            if (x1 >= 0 && x1 < SCREEN_WIDTH && y1 >= 0 && y1 < SCREEN_HEIGHT)
-                pixelBuffer[y1 * pixelPerRow + x1] = color;
-
-            if (x1 == x2 && y1 == y2)
-                break;
-
-            int e2 = 2 * err;
-            if (e2 > -dy)
+            else if (arg == "--headless")
             {
-                err -= dy;
-                x1 += sx;
+                headless = true;
             }
-            if (e2 < dx)
+            else if (arg == "--frames" && hasValue)
             {
-                err += dx;
-                y1 += sy;
+                frames = std::atoi(args[++i].c_str());
             }
-        }
-    }
-
-    void drawRay(float x1, float y1, float angle, float distance)
-    {
-        float k = 0.005f;
-        float stepSize = 1.0f;
-        float stepX = std::cos(angle) * stepSize;
-        float stepY = std::sin(angle) * stepSize;
-        float currentX = x1;
-        float currentY = y1;
-
-        for (float d = 0.0f; d <= distance; d += stepSize)
-        {
-            float attenuation = expf(-k * d);
-            attenuation = std::max(0.0f, std::min(1.0f, attenuation));
-            Uint8 alpha = static_cast<Uint8>(attenuation * 255.0f);
-
-            if (alpha == 0)
+            else if (arg == "--rooms" && hasValue)
             {
-                break;
+                if (std::sscanf(args[++i].c_str(), "%dx%d", &roomCols, &roomRows) != 2 || roomCols <= 0 || roomRows <= 0)
+                {
+                    std::cerr << "Invalid --rooms, expected COLSxROWS" << std::endl;
+                    return false;
+                }
             }
-
-            Uint32 pixelColor = (alpha << 24) | (255 << 16) | (255 << 8) | 102;
-            int drawX = static_cast<int>(currentX);
-            int drawY = static_cast<int>(currentY);
-
-            if (drawX <= 0 || drawX >= SCREEN_WIDTH || drawY <= 0 || drawY >= SCREEN_HEIGHT)
+            else if (arg == "--bake-world" && hasValue)
             {
-                break;
+                bakeWorldPath = args[++i].c_str();
+            }
+            else if (arg == "--world" && hasValue)
+            {
+                worldPath = args[++i].c_str();
+            }
+            else if (arg == "--tile-size" && hasValue)
+            {
+                tileSize = static_cast<float>(std::atof(args[++i].c_str()));
+            }
+            else if (arg == "--stream-budget" && hasValue)
+            {
+                streamBudgetMB = std::atoi(args[++i].c_str());
+            }
+            else if (arg == "--capture" && hasValue)
+            {
+                capturePath = args[++i].c_str();
+            }
+            else if (arg == "--capture-policy" && hasValue)
+            {
+                std::string policy = args[++i].c_str();
+                if (policy != "drop" && policy != "block")
+                {
+                    std::cerr << "Invalid --capture-policy, expected drop or block" << std::endl;
+                    return false;
+                }
+                capturePolicy = policy == "block" ? FrameCapture::POLICY_BLOCK : FrameCapture::POLICY_DROP;
+            }
+            else if (arg == "--capture-pool" && hasValue)
+            {
+                capturePool = std::atoi(args[++i].c_str());
+            }
+            else if (arg == "--gbuffer")
+            {
+                visibilityBuffers = true;
+            }
+            else if (arg == "--area-light" && hasValue)
+            {
+                char shape[16] = {0};
+                float size = 0.0f, angleDeg = 0.0f;
+                int fields = std::sscanf(args[++i].c_str(), "%15[a-z]:%f:%f", shape, &size, &angleDeg);
+                std::string shapeName = shape;
+                if (fields < 2 || size <= 0.0f || (shapeName != "disc" && shapeName != "segment"))
+                {
+                    std::cerr << "Invalid --area-light, expected disc:RADIUS or segment:LENGTH[:ANGLE]" << std::endl;
+                    return false;
+                }
+                areaLight = AreaLight(shapeName == "disc" ? AreaLight::SHAPE_DISC : AreaLight::SHAPE_SEGMENT,
+                                      size, angleDeg * PI / 180.0f);
+            }
+            else if (arg == "--light-samples" && hasValue)
+            {
+                lightSamples = std::max(1, std::atoi(args[++i].c_str()));
+            }
+            else if (arg == "--accumulate")
+            {
+                accumulate = true;
+            }
+            else if (arg == "--smooth-walls")
+            {
+                smoothWalls = true;
+            }
+            else if (arg == "--lights" && hasValue)
+            {
+                lightCount = std::max(0, std::atoi(args[++i].c_str()));
+            }
+            else if (arg == "--config" && hasValue)
+            {
+                ++i; // read before everything else
+            }
+            else if (arg == "--scene" && hasValue)
+            {
+                scenePath = args[++i];
+            }
+            else if (arg == "--falloff" && hasValue)
+            {
+                falloff = static_cast<float>(std::atof(args[++i].c_str()));
+                if (falloff <= 0.0f)
+                {
+                    std::cerr << "Invalid --falloff, expected a positive number" << std::endl;
+                    return false;
+                }
+            }
+            else if (arg == "--rays" && hasValue)
+            {
+                baseRays = std::max(1, std::atoi(args[++i].c_str()));
+            }
+            else if (arg == "--threads" && hasValue)
+            {
+                threads = std::max(0, std::atoi(args[++i].c_str()));
+            }
+            else if (arg == "--index" && hasValue)
+            {
+                std::string name = args[++i];
+                const char *const names[] = {"scan", "portals", "grid", "lbvh"};
+                const SpatialIndex indexes[] = {INDEX_SCAN, INDEX_PORTALS, INDEX_GRID, INDEX_LBVH};
+                const size_t found = std::find(names, names + 4, name) - names;
+                if (found == 4)
+                {
+                    std::cerr << "Invalid --index, expected scan, portals, grid or lbvh" << std::endl;
+                    return false;
+                }
+                index = indexes[found];
+            }
+            else if (arg == "--distance-field" && hasValue)
+            {
+                fieldCell = static_cast<float>(std::atof(args[++i].c_str()));
+                if (fieldCell <= 0.0f)
+                {
+                    std::cerr << "Invalid --distance-field, expected a positive cell size" << std::endl;
+                    return false;
+                }
+            }
+            else if (arg == "--zoom" && hasValue)
+            {
+                zoom = std::max(MIN_ZOOM, std::min(MAX_ZOOM, static_cast<float>(std::atof(args[++i].c_str()))));
+            }
+            else if ((arg == "--golden-record" || arg == "--golden-check") && hasValue)
+            {
+                goldenRecord = arg == "--golden-record";
+                goldenDir = args[++i].c_str();
+            }
+            else if (arg == "--golden-tolerance" && hasValue)
+            {
+                goldenTolerance = std::atoi(args[++i].c_str());
+            }
+            else if (arg == "--golden-max-bad" && hasValue)
+            {
+                goldenMaxBadPixels = std::atoi(args[++i].c_str());
+            }
+            else if (arg == "--golden-max-diff" && hasValue)
+            {
+                goldenMaxDiff = std::atoi(args[++i].c_str());
+            }
+            else
+            {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                std::cerr << "Usage: " << program << " [--config FILE] [--size WxH] [--headless] [--frames N] [--rooms CxR] [--scene FILE]"
+                          << " [--bake-world FILE [--tile-size S]] [--world FILE [--stream-budget MB]]"
+                          << " [--capture PATTERN [--capture-policy drop|block] [--capture-pool N]] [--zoom Z] [--gbuffer] [--smooth-walls] [--lights N]"
+                          << " [--area-light disc:R|segment:L[:DEG] [--light-samples N] [--accumulate]]"
+                          << " [--falloff K] [--rays N] [--threads N] [--index scan|portals|grid|lbvh] [--distance-field CELL]"
+                          << " [--golden-record DIR | --golden-check DIR [--golden-tolerance T] [--golden-max-bad N] [--golden-max-diff D]]"
+                          << std::endl;
+                return false;
             }
-
-            pixelBuffer[drawY * pixelPerRow + drawX] = pixelColor;
-            currentX += stepX;
-            currentY += stepY;
         }
+        if (headless && frames <= 0)
+            frames = 100;
+        return true;
     }
 
-    void drawWalls(const Scene &scene)
+    // Turn a config file into the equivalent options: each `key = value`
+    // line becomes --key value, and switches such as `headless` take true or
+    // false. # starts a comment.
+    static bool readConfig(const std::string &path, std::vector<std::string> &args)
     {
-        for (const Segment &wall : scene.getWalls())
+        std::ifstream file(path);
+        if (!file)
         {
-            int x1 = static_cast<int>(wall.x1);
-            int y1 = static_cast<int>(wall.y1);
-            int x2 = static_cast<int>(wall.x2);
-            int y2 = static_cast<int>(wall.y2);
-            drawLine(x1, y1, x2, y2, 0xFFFFFFFF);
+            std::cerr << "Could not open config file " << path << std::endl;
+            return false;
         }
-    }
-};
 
-// RayCaster class to handle ray tracing logic
-class RayCaster
-{
-private:
-    const Scene &scene;
-    Renderer &renderer;
-
-public:
-    RayCaster(const Scene &scene, Renderer &renderer)
-        : scene(scene), renderer(renderer) {}
-
-    void traceRays(float originX, float originY)
-    {
-        const float ANGLE_STEP_RAD = ANGLE_STEP_DEG * PI / 180.0f;
-        const int NUM_RAYS = static_cast<int>(360.0f / ANGLE_STEP_DEG);
-
-        for (int i = 0; i < NUM_RAYS; ++i)
+        const char *const switches[] = {"headless", "gbuffer", "accumulate", "smooth-walls"};
+        auto trim = [](const std::string &text)
         {
-            // Calculate the angle for this ray
-            float angle = i * ANGLE_STEP_RAD;
-
-            // Create a ray at the given angle
-            Ray ray(originX, originY, angle);
-
-            Point closestIntersection = {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity()};
-            float closestDistance = std::numeric_limits<float>::infinity();
+            size_t first = text.find_first_not_of(" \t\r");
+            return first == std::string::npos ? std::string() : text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+        };
 
-            // Check the ray against all walls
-            for (const Segment &wall : scene.getWalls())
+        std::string line;
+        for (int lineNumber = 1; std::getline(file, line); ++lineNumber)
+        {
+            line = trim(line.substr(0, line.find('#')));
+            if (line.empty())
+                continue;
+            size_t equals = line.find('=');
+            std::string key = trim(line.substr(0, equals));
+            std::string value = equals == std::string::npos ? std::string() : trim(line.substr(equals + 1));
+            if (equals == std::string::npos || key.empty())
             {
-                if (scene.isPointOnSegment(originX, originY, wall))
-                {
-                    return; // could improve perf
-                }
-                Point intersection = ray.cast(wall);
-                float distance = hypot(intersection.x - originX, intersection.y - originY);
-
-                if (distance < closestDistance)
-                {
-                    closestIntersection = intersection;
-                    closestDistance = distance;
-                }
+                std::cerr << path << ":" << lineNumber << ": expected key = value" << std::endl;
+                return false;
             }
 
-            // Draw the ray
-            renderer.drawRay(originX, originY, angle, closestDistance);
+            if (std::find(std::begin(switches), std::end(switches), key) == std::end(switches))
+            {
+                args.push_back("--" + key);
+                args.push_back(value);
+            }
+            else if (value == "true")
+            {
+                args.push_back("--" + key);
+            }
+            else if (value != "false")
+            {
+                std::cerr << path << ":" << lineNumber << ": " << key << " takes true or false" << std::endl;
+                return false;
+            }
         }
+        return true;
     }
 };
 
@@ -322,11 +325,51 @@ private:
     Scene scene;
     Renderer *sceneRenderer;
     RayCaster *rayCaster;
+    FrameArena frameArena; // transient per-frame data, declared before its users
+    ThreadPool pool;       // one worker per frame arena worker
+    WallCuller culler;
+    std::vector<WallCuller> lightCullers; // per pool worker, for the static lights
+    TiledLighting tiledLighting;
+    VisibilityBuffer visibility;
+    DistanceField distanceField; // built on first use and whenever the scene changes
+    WallIndex wallIndex;         // grid and LBVH for --index grid|lbvh, built when the scene loads or changes
+    StreamingWorld *world;
+    FrameCapture *capture;
+    Settings settings;
+    Camera camera;
+    Transform transform;
     bool running;
+    int frameCount;
+    std::chrono::steady_clock::time_point lastFrame;
+    Point lastOrigin;
+    std::chrono::steady_clock::time_point lastOriginTime;
+    std::filesystem::file_time_type configModified;
+    std::chrono::steady_clock::time_point nextConfigPoll;
+
+    // State the temporal accumulation history was built under
+    Point historyOrigin;
+    Transform historyTransform;
+    unsigned int historySceneVersion;
+    int historyWidth, historyHeight;
+    int historyFrames;
 
 public:
-    Application() : window(nullptr), renderer(nullptr),
-                    sceneRenderer(nullptr), rayCaster(nullptr), running(true) {}
+    Application(const Settings &settings) : window(nullptr), renderer(nullptr),
+                                            sceneRenderer(nullptr), rayCaster(nullptr),
+                                            frameArena(settings.threads > 0 ? settings.threads
+                                                                            : static_cast<int>(std::thread::hardware_concurrency())),
+                                            pool(frameArena.getWorkerCount()),
+                                            culler(frameArena.get()), tiledLighting(pool), world(nullptr), capture(nullptr),
+                                            settings(settings),
+                                            transform(camera.transform(settings.width, settings.height)),
+                                            running(true), frameCount(0), lastOrigin({0.0f, 0.0f}),
+                                            historyOrigin({0.0f, 0.0f}), historyTransform(transform),
+                                            historySceneVersion(0), historyWidth(0), historyHeight(0), historyFrames(0)
+    {
+        lightCullers.reserve(frameArena.getWorkerCount());
+        for (int worker = 0; worker < frameArena.getWorkerCount(); ++worker)
+            lightCullers.emplace_back(frameArena.worker(worker));
+    }
 
     ~Application()
     {
@@ -335,6 +378,37 @@ public:
 
     bool initialize()
     {
+        if (!buildScene())
+            return false;
+        camera.zoom = settings.zoom;
+        if (!settings.configPath.empty())
+        {
+            std::error_code error;
+            configModified = std::filesystem::last_write_time(settings.configPath, error);
+        }
+
+        if (!settings.worldPath.empty())
+        {
+            world = new StreamingWorld();
+            if (!world->open(settings.worldPath, static_cast<size_t>(settings.streamBudgetMB) << 20))
+                return false;
+            scene.setWalls({});
+            Rect worldBounds = world->bounds();
+            camera.centerX = worldBounds.minX + std::min(ROOM_SIZE * 0.5f, (worldBounds.maxX - worldBounds.minX) * 0.5f);
+            camera.centerY = worldBounds.minY + std::min(ROOM_SIZE * 0.5f, (worldBounds.maxY - worldBounds.minY) * 0.5f);
+        }
+
+        placeLights();
+        indexScene(true);
+
+        if (settings.headless)
+        {
+            sceneRenderer = new Renderer(nullptr, settings.width, settings.height);
+            rayCaster = new RayCaster(*sceneRenderer, pool);
+            applyTuning();
+            return startCapture();
+        }
+
         // Initialize SDL
         if (SDL_Init(SDL_INIT_VIDEO) < 0)
         {
@@ -343,7 +417,8 @@ public:
         }
 
         window = SDL_CreateWindow("2D Ray Casting", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                                  SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+                                  settings.width, settings.height,
+                                  SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
         if (!window)
         {
             std::cerr << "Window could not be created! SDL_Error: " << SDL_GetError() << std::endl;
@@ -360,24 +435,218 @@ public:
             return false;
         }
 
-        // Create scene renderer and ray caster
-        sceneRenderer = new Renderer(renderer);
-        rayCaster = new RayCaster(scene, *sceneRenderer);
+        // Create scene renderer and ray caster at the drawable size, which is
+        // larger than the window size on HiDPI displays
+        int outputWidth, outputHeight;
+        if (SDL_GetRendererOutputSize(renderer, &outputWidth, &outputHeight) < 0)
+        {
+            outputWidth = settings.width;
+            outputHeight = settings.height;
+        }
+        sceneRenderer = new Renderer(renderer, outputWidth, outputHeight);
+        rayCaster = new RayCaster(*sceneRenderer, pool);
+        applyTuning();
+
+        return startCapture();
+    }
 
+    // Walls from the settings: a scene file, else generated rooms, else the
+    // scene as it is
+    bool buildScene()
+    {
+        if (!settings.scenePath.empty())
+        {
+            if (!scene.loadText(settings.scenePath))
+                return false;
+            Rect sceneBounds = scene.bounds();
+            camera.centerX = (sceneBounds.minX + sceneBounds.maxX) * 0.5f;
+            camera.centerY = (sceneBounds.minY + sceneBounds.maxY) * 0.5f;
+        }
+        else if (settings.roomCols > 0)
+        {
+            scene.generateRooms(settings.roomCols, settings.roomRows);
+            // Start on the first room
+            camera.centerX = ROOM_SIZE * 0.5f;
+            camera.centerY = ROOM_SIZE * 0.5f;
+        }
         return true;
     }
 
+    // Scatter the --lights static lights; without them a scene file keeps its own
+    void placeLights()
+    {
+        if (settings.lightCount > 0 || settings.scenePath.empty())
+            scene.scatterLights(settings.lightCount, world ? world->bounds() : scene.bounds());
+    }
+
+    // Build the wall index when culling uses its grid or LBVH and the scene
+    // changed since, with the time each stage took if report is set. A scene
+    // file's index is cached next to it and read back while the file is
+    // unchanged.
+    void indexScene(bool report)
+    {
+        if ((settings.index != INDEX_GRID && settings.index != INDEX_LBVH) || wallIndex.isBuiltFor(scene))
+            return;
+        const uint64_t sceneHash = scene.getSourceHash();
+        const std::string cachePath = IndexCache::pathFor(settings.scenePath);
+        auto start = std::chrono::steady_clock::now();
+        if (sceneHash != 0 && IndexCache::load(cachePath, sceneHash, scene, wallIndex))
+        {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            if (report)
+                std::cout << "Loaded the index of " << scene.getWalls().size() << " walls from " << cachePath << " in "
+                          << elapsed.count() << " ms" << std::endl;
+            return;
+        }
+        wallIndex.build(scene, pool);
+        if (sceneHash != 0)
+            IndexCache::save(cachePath, sceneHash, wallIndex);
+        if (!report)
+            return;
+        const WallIndex::BuildTimes &times = wallIndex.getBuildTimes();
+        std::cout << "Indexed " << scene.getWalls().size() << " walls on " << pool.getWorkerCount() << " threads in "
+                  << times.mortonMs + times.sortMs + times.bvhMs + times.gridMs << " ms: Morton keys "
+                  << times.mortonMs << " ms, sort " << times.sortMs << " ms, LBVH " << times.bvhMs << " ms, grid "
+                  << times.gridMs << " ms" << std::endl;
+    }
+
+    // Hand the light tuning settings to the renderer and ray caster
+    void applyTuning()
+    {
+        sceneRenderer->setFalloff(settings.falloff);
+        rayCaster->setBaseRays(settings.baseRays);
+        rayCaster->setDistanceField(settings.fieldCell > 0.0f ? &distanceField : nullptr);
+    }
+
+    // Re-read the config file when it changed on disk, at most every
+    // CONFIG_POLL_SECONDS, and apply it
+    void pollConfig()
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (settings.configPath.empty() || now < nextConfigPoll)
+            return;
+        nextConfigPoll = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                   std::chrono::duration<float>(CONFIG_POLL_SECONDS));
+
+        std::error_code error;
+        std::filesystem::file_time_type modified = std::filesystem::last_write_time(settings.configPath, error);
+        if (error || modified == configModified)
+            return;
+        configModified = modified;
+
+        Settings updated;
+        updated.program = settings.program;
+        if (!updated.parse(settings.commandLine))
+        {
+            std::cerr << "Keeping the current settings" << std::endl;
+            return;
+        }
+        applySettings(updated);
+        std::cout << "Reloaded " << settings.configPath << std::endl;
+    }
+
+    // Switch to re-read settings mid-session. The light, view, quality and
+    // scene settings apply at once; the thread count, world file, capture and
+    // headless mode keep their launch values until the next start.
+    void applySettings(Settings updated)
+    {
+        if (updated.threads != settings.threads || updated.worldPath != settings.worldPath ||
+            updated.capturePath != settings.capturePath || updated.headless != settings.headless)
+            std::cout << "Thread count, world, capture and headless changes take effect on restart" << std::endl;
+        updated.threads = settings.threads;
+        updated.worldPath = settings.worldPath;
+        updated.capturePath = settings.capturePath;
+        updated.headless = settings.headless;
+
+        const bool sceneChanged = updated.scenePath != settings.scenePath || updated.roomCols != settings.roomCols ||
+                                  updated.roomRows != settings.roomRows || updated.lightCount != settings.lightCount;
+        const bool resized = updated.width != settings.width || updated.height != settings.height;
+        const bool zoomed = updated.zoom != settings.zoom;
+        settings = updated;
+
+        applyTuning();
+        if (zoomed)
+            camera.zoom = settings.zoom;
+        if (resized && window)
+        {
+            SDL_SetWindowSize(window, settings.width, settings.height);
+            onResize();
+        }
+        else if (resized)
+        {
+            sceneRenderer->resize(settings.width, settings.height);
+        }
+        if (sceneChanged && !world)
+        {
+            // Rebuild from the default scene, keeping the old one if the new scene file fails
+            Scene previous = std::move(scene);
+            scene = Scene();
+            if (buildScene())
+                placeLights();
+            else
+                scene = std::move(previous);
+        }
+        indexScene(true);
+    }
+
+    bool startCapture()
+    {
+        if (settings.capturePath.empty())
+            return true;
+        capture = new FrameCapture(settings.capturePath, settings.capturePolicy, settings.capturePool);
+        return capture->start(sceneRenderer->getWidth(), sceneRenderer->getHeight());
+    }
+
     void run()
     {
+        auto start = std::chrono::steady_clock::now();
+        lastFrame = start;
         while (running)
         {
             handleEvents();
+            pollConfig();
             render();
+
+            ++frameCount;
+            if (settings.frames > 0 && frameCount >= settings.frames)
+                running = false;
+        }
+
+        if (settings.headless)
+        {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << frameCount << " frames at " << sceneRenderer->getWidth() << "x" << sceneRenderer->getHeight()
+                      << ", " << elapsed.count() / std::max(frameCount, 1) << " ms/frame" << std::endl;
+            std::cout << "Frame arena peak " << frameArena.getPeak() / 1024 << " KiB of "
+                      << frameArena.getCapacity() / 1024 << " KiB reserved" << std::endl;
+            std::cout << "Last frame examined " << culler.getConsideredCount() << " of " << scene.getWalls().size()
+                      << " walls, " << culler.getCandidates().size() << " candidates" << std::endl;
+            std::cout << "Wall layer drawn " << sceneRenderer->getWallLayerBuilds() << " times, "
+                      << 100.0 * sceneRenderer->getUploadedFraction() << "% of pixels uploaded per frame" << std::endl;
+            if (!scene.getLights().empty())
+                std::cout << "Tiled lighting: " << scene.getLights().size() + 1 << " lights on " << pool.getWorkerCount()
+                          << " threads, " << tiledLighting.getLitTileCount() << " lit tiles, "
+                          << tiledLighting.getBinnedCount() << " light-tile pairs" << std::endl;
+            reportTraceStats();
+            if (settings.visibilityBuffers)
+                reportVisibility();
+        }
+
+        if (capture)
+        {
+            capture->stop(); // flushes queued frames
+            std::cout << "Captured " << capture->getWrittenCount() << " frames, dropped " << capture->getDroppedCount()
+                      << ", failed " << capture->getFailedCount() << std::endl;
+            delete capture;
+            capture = nullptr;
         }
     }
 
     void handleEvents()
     {
+        if (settings.headless)
+            return;
+
         SDL_Event event;
         while (SDL_PollEvent(&event))
         {
@@ -385,27 +654,251 @@ public:
             {
                 running = false;
             }
+            else if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+            {
+                onResize();
+            }
+            else if (event.type == SDL_MOUSEWHEEL && event.wheel.y != 0)
+            {
+                camera.zoomAt(originOnScreen(), std::pow(1.1f, static_cast<float>(event.wheel.y)),
+                              sceneRenderer->getWidth(), sceneRenderer->getHeight());
+            }
+            else if (event.type == SDL_MOUSEMOTION && (event.motion.state & SDL_BUTTON_RMASK))
+            {
+                // Drag the world with the right mouse button
+                Point ratio = pixelRatio();
+                camera.pan(-event.motion.xrel * ratio.x, -event.motion.yrel * ratio.y, transform);
+            }
         }
+
+        // Pan with the arrow keys or WASD
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        float dt = std::chrono::duration<float>(now - lastFrame).count();
+        lastFrame = now;
+
+        const Uint8 *keys = SDL_GetKeyboardState(nullptr);
+        float dx = static_cast<float>((keys[SDL_SCANCODE_RIGHT] || keys[SDL_SCANCODE_D]) - (keys[SDL_SCANCODE_LEFT] || keys[SDL_SCANCODE_A]));
+        float dy = static_cast<float>((keys[SDL_SCANCODE_DOWN] || keys[SDL_SCANCODE_S]) - (keys[SDL_SCANCODE_UP] || keys[SDL_SCANCODE_W]));
+        if (dx != 0.0f || dy != 0.0f)
+            camera.pan(dx * PAN_SPEED * dt, dy * PAN_SPEED * dt, transform);
     }
 
-    void render()
+    void onResize()
+    {
+        int outputWidth, outputHeight;
+        if (SDL_GetRendererOutputSize(renderer, &outputWidth, &outputHeight) < 0)
+            return;
+        sceneRenderer->resize(outputWidth, outputHeight);
+    }
+
+    // Drawable pixels per window point
+    Point pixelRatio() const
     {
-        // Get mouse position for ray origin
+        int windowWidth, windowHeight;
+        SDL_GetWindowSize(window, &windowWidth, &windowHeight);
+        return {windowWidth > 0 ? static_cast<float>(sceneRenderer->getWidth()) / windowWidth : 1.0f,
+                windowHeight > 0 ? static_cast<float>(sceneRenderer->getHeight()) / windowHeight : 1.0f};
+    }
+
+    // Ray origin in screen pixels: the mouse in a window, or a fixed orbit when headless
+    Point originOnScreen() const
+    {
+        if (settings.headless)
+        {
+            float angle = frameCount * 0.05f;
+            float radius = 0.25f * std::min(sceneRenderer->getWidth(), sceneRenderer->getHeight());
+            return {sceneRenderer->getWidth() * 0.5f + radius * std::cos(angle),
+                    sceneRenderer->getHeight() * 0.5f + radius * std::sin(angle)};
+        }
+
+        // Mouse coordinates are in window points; scale them to drawable pixels
         int mouseX, mouseY;
         SDL_GetMouseState(&mouseX, &mouseY);
-        float rayOriginX = static_cast<float>(mouseX);
-        float rayOriginY = static_cast<float>(mouseY);
+        Point ratio = pixelRatio();
+        return {mouseX * ratio.x, mouseY * ratio.y};
+    }
+
+    const Renderer &getRenderer() const
+    {
+        return *sceneRenderer;
+    }
+
+    // Visibility results of the last frame, when --gbuffer is on
+    const VisibilityBuffer &getVisibility() const
+    {
+        return visibility;
+    }
+
+    void reportVisibility() const
+    {
+        size_t litPixels = 0;
+        for (int y = 0; y < sceneRenderer->getHeight(); ++y)
+        {
+            for (int x = 0; x < sceneRenderer->getWidth(); ++x)
+                litPixels += visibility.litBy(x, y) != 0;
+        }
+        std::cout << "Last frame: " << litPixels << " lit pixels";
+        for (int light = 0; light < visibility.getLightCount(); ++light)
+            std::cout << ", light " << light << " sees " << visibility.wallsSeenBy(light).size() << " walls";
+        std::cout << std::endl;
+    }
+
+    void reportTraceStats() const
+    {
+        const RayCaster::TraceStats &stats = rayCaster->getTraceStats();
+        if (stats.frames == 0)
+            return;
+        std::cout << "Hit cache: " << stats.reusedFrames << " of " << stats.frames << " frames reused, "
+                  << (stats.seeded ? 100.0 * stats.seedHits / stats.seeded : 0.0) << "% of rays kept last frame's wall, "
+                  << (stats.sweepSeeded ? 100.0 * stats.sweepSeedHits / stats.sweepSeeded : 0.0)
+                  << "% hit the previous ray's wall" << std::endl;
+        if (stats.marchedRays)
+            std::cout << "Distance field: " << distanceField.getGrid().getColumns() << "x" << distanceField.getGrid().getRows()
+                      << " cells of " << distanceField.getGrid().getCellSize() << ", " << distanceField.getGrid().getListedCount()
+                      << " wall entries, " << static_cast<double>(stats.marchSteps) / stats.marchedRays
+                      << " cells and " << static_cast<double>(stats.marchTests) / stats.marchedRays
+                      << " tests per marched ray" << std::endl;
+        if (stats.candidateTests)
+            std::cout << "Intersection tests: " << stats.tests << " of " << stats.candidateTests << " made, "
+                      << stats.candidateTests - stats.tests << " saved ("
+                      << 100.0 * (stats.candidateTests - stats.tests) / stats.candidateTests
+                      << "%)" << std::endl;
+    }
+
+    void render()
+    {
+        renderFrame(originOnScreen());
+    }
+
+    // Render one frame lit from a screen-space origin
+    void renderFrame(Point screenOrigin)
+    {
+        frameArena.reset();
+        transform = camera.transform(sceneRenderer->getWidth(), sceneRenderer->getHeight());
+
+        // Get ray origin in world coordinates
+        Point rayOrigin = transform.toWorld(screenOrigin);
+        const Rect viewport = transform.visibleWorld(sceneRenderer->getWidth(), sceneRenderer->getHeight());
+
+        if (world)
+            streamWorld(rayOrigin, viewport);
+
+        // Point lights march the distance field when there is one; area lights always cull
+        const bool areaMode = settings.areaLight.shape != AreaLight::SHAPE_POINT;
+        if (settings.fieldCell > 0.0f && !distanceField.isBuiltFor(scene, settings.fieldCell))
+            distanceField.build(scene, settings.fieldCell, pool);
+        indexScene(false);
+        if (areaMode || settings.fieldCell <= 0.0f)
+            culler.cull(scene, rayOrigin, lightCutoffRadius(settings.falloff) + settings.areaLight.extent(), viewport,
+                        areaMode && settings.index == INDEX_PORTALS ? INDEX_SCAN : settings.index, &wallIndex);
+
+        // Static lights are shaded from the visibility buffer too; it is
+        // started once here for either use
+        const bool tiledLights = !areaMode && !scene.getLights().empty();
+        VisibilityBuffer *frameVisibility = settings.visibilityBuffers ? &visibility : nullptr;
+        if (frameVisibility || tiledLights)
+            visibility.beginFrame(sceneRenderer->getWidth(), sceneRenderer->getHeight());
 
         sceneRenderer->beginFrame();
-        rayCaster->traceRays(rayOriginX, rayOriginY);
-        sceneRenderer->drawWalls(scene);
+        if (areaMode)
+        {
+            rayCaster->traceAreaLight(settings.areaLight, rayOrigin.x, rayOrigin.y, transform, culler,
+                                      settings.lightSamples, static_cast<unsigned int>(frameCount));
+            sceneRenderer->resolveLight(temporalWeight(rayOrigin));
+        }
+        else if (tiledLights)
+        {
+            shadeLights(rayOrigin, viewport);
+        }
+        else
+        {
+            rayCaster->traceRays(rayOrigin.x, rayOrigin.y, transform, culler, frameVisibility);
+        }
+        sceneRenderer->drawWalls(scene, transform, settings.smoothWalls);
+        if (capture)
+            capture->submit(sceneRenderer->getPixels(), sceneRenderer->getPixelPerRow(),
+                            sceneRenderer->getWidth(), sceneRenderer->getHeight());
         sceneRenderer->endFrame();
     }
 
+    // Light the frame from the mouse light and every static light with tiled
+    // shading. The lights are culled and traced in parallel, one culler per
+    // pool worker, or marched through the distance field, into the
+    // visibility buffer the tiles read from, which renderFrame started.
+    void shadeLights(Point rayOrigin, const Rect &viewport)
+    {
+        const int rayCount = rayCaster->rayCount(transform.scale);
+        const float radius = lightCutoffRadius(settings.falloff);
+        visibility.addLight(rayOrigin, rayCount);
+        for (Point light : scene.getLights())
+            visibility.addLight(light, rayCount);
+
+        pool.parallelFor(visibility.getLightCount(), [&](int light, int worker)
+        {
+            const Point origin = visibility.getOrigin(light);
+            if (settings.fieldCell > 0.0f)
+            {
+                RayCaster::marchRays(origin, distanceField, rayCount, radius, visibility.getRays(light));
+                return;
+            }
+
+            // A light off screen is shadowed by walls between it and the
+            // viewport too, so grow the region to take in the light
+            const Rect region = {std::min(viewport.minX, origin.x), std::min(viewport.minY, origin.y),
+                                 std::max(viewport.maxX, origin.x), std::max(viewport.maxY, origin.y)};
+            WallCuller &lightCuller = lightCullers[worker];
+            lightCuller.cull(scene, origin, radius, region, settings.index, &wallIndex);
+            RayCaster::castRays(origin, lightCuller, rayCount, radius, visibility.getRays(light));
+        });
+        tiledLighting.shade(*sceneRenderer, visibility, transform, frameArena.get());
+    }
+
+    // Weight of the accumulated history for this frame: a running mean over
+    // the frames since the light, view or scene last changed, capped so it
+    // becomes a moving average
+    float temporalWeight(Point origin)
+    {
+        bool unchanged = settings.accumulate && historyFrames > 0 &&
+                         origin.x == historyOrigin.x && origin.y == historyOrigin.y &&
+                         transform.scale == historyTransform.scale && transform.offsetX == historyTransform.offsetX &&
+                         transform.offsetY == historyTransform.offsetY && scene.getVersion() == historySceneVersion &&
+                         sceneRenderer->getWidth() == historyWidth && sceneRenderer->getHeight() == historyHeight;
+        historyFrames = unchanged ? std::min(historyFrames + 1, ACCUMULATION_MAX_FRAMES) : 1;
+        historyOrigin = origin;
+        historyTransform = transform;
+        historySceneVersion = scene.getVersion();
+        historyWidth = sceneRenderer->getWidth();
+        historyHeight = sceneRenderer->getHeight();
+        return (historyFrames - 1) / static_cast<float>(historyFrames);
+    }
+
+    // Page world tiles around the view and light, prefetching along the origin's motion
+    void streamWorld(Point rayOrigin, const Rect &viewport)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        float dt = std::chrono::duration<float>(now - lastOriginTime).count();
+        Point velocity = {0.0f, 0.0f};
+        if (frameCount > 0 && dt > 0.0f)
+            velocity = {(rayOrigin.x - lastOrigin.x) / dt, (rayOrigin.y - lastOrigin.y) / dt};
+        lastOrigin = rayOrigin;
+        lastOriginTime = now;
+
+        const float radius = lightCutoffRadius(settings.falloff);
+        Rect needed = {std::min(viewport.minX, rayOrigin.x - radius), std::min(viewport.minY, rayOrigin.y - radius),
+                       std::max(viewport.maxX, rayOrigin.x + radius), std::max(viewport.maxY, rayOrigin.y + radius)};
+        world->update(scene, needed, velocity, settings.headless, frameArena.get());
+    }
+
     void cleanup()
     {
+        delete capture;
+        capture = nullptr;
+        delete world;
+        world = nullptr;
         delete rayCaster;
+        rayCaster = nullptr;
         delete sceneRenderer;
+        sceneRenderer = nullptr;
 
         if (renderer)
         {
@@ -423,9 +916,156 @@ public:
     }
 };
 
-int main()
+// Renders a fixed catalogue of scenes and origins headlessly and records
+// them as reference images, or compares against the recorded references so
+// rendering changes that alter the picture are caught
+class GoldenSuite
 {
-    Application app;
+private:
+    struct Case
+    {
+        const char *name;
+        int width, height;
+        int roomCols, roomRows;     // 0 for the built-in scene
+        float zoom;
+        Point origin;               // screen position as a fraction of the output size
+        int reloadCols, reloadRows; // rooms rendered first and then reloaded away from, 0 for none
+    };
+
+    static std::vector<Case> catalogue()
+    {
+        return {
+            {"scene-center", 800, 600, 0, 0, 1.0f, {0.5f, 0.5f}, 0, 0},
+            {"scene-corner", 800, 600, 0, 0, 1.0f, {0.0625f, 0.0833f}, 0, 0},
+            {"scene-enclosed", 800, 600, 0, 0, 1.0f, {0.1875f, 0.3333f}, 0, 0},
+            {"scene-on-wall", 800, 600, 0, 0, 1.0f, {0.375f, 0.3333f}, 0, 0},
+            {"scene-edge", 800, 600, 0, 0, 1.0f, {0.99f, 0.99f}, 0, 0},
+            {"scene-1080p", 1920, 1080, 0, 0, 1.0f, {0.6f, 0.45f}, 0, 0},
+            {"rooms-overview", 800, 600, 12, 12, 0.25f, {0.5f, 0.5f}, 0, 0},
+            {"rooms-closeup", 800, 600, 4, 4, 4.0f, {0.55f, 0.4f}, 0, 0},
+            {"rooms-wide", 1280, 720, 30, 30, 1.0f, {0.3f, 0.7f}, 0, 0},
+            {"rooms-reloaded", 800, 600, 2, 2, 0.5f, {0.5f, 0.5f}, 8, 8},
+        };
+    }
+
+public:
+    static int run(const Settings &base)
+    {
+        int failures = 0;
+        std::vector<Uint8> rendered, reference;
+        for (const Case &test : catalogue())
+        {
+            Settings settings = base;
+            settings.headless = true;
+            settings.capturePath.clear();
+            settings.worldPath.clear();
+            settings.width = test.width;
+            settings.height = test.height;
+            settings.roomCols = test.roomCols;
+            settings.roomRows = test.roomRows;
+            settings.zoom = test.zoom;
+
+            // A reload replaces the scene in place, so nothing built for the
+            // first scene may be used for the second
+            Settings reloaded = settings;
+            if (test.reloadCols > 0)
+            {
+                settings.roomCols = test.reloadCols;
+                settings.roomRows = test.reloadRows;
+            }
+
+            Application app(settings);
+            if (!app.initialize())
+                return -1;
+            if (test.reloadCols > 0)
+            {
+                app.renderFrame({test.origin.x * test.width, test.origin.y * test.height});
+                app.applySettings(reloaded);
+            }
+            app.renderFrame({test.origin.x * test.width, test.origin.y * test.height});
+            const Renderer &frame = app.getRenderer();
+            flattenToRGB(frame.getPixels(), frame.getPixelPerRow(), frame.getWidth(), frame.getHeight(), rendered);
+
+            std::string path = base.goldenDir + "/" + test.name + ".ppm";
+            if (base.goldenRecord)
+            {
+                if (!writePPM(path.c_str(), rendered, test.width, test.height))
+                {
+                    std::cerr << "Could not write " << path << std::endl;
+                    return -1;
+                }
+                std::cout << "recorded " << path << std::endl;
+                continue;
+            }
+
+            int width, height;
+            if (!readPPM(path.c_str(), reference, width, height) || width != test.width || height != test.height)
+            {
+                std::cout << "FAIL " << test.name << ": missing or mismatched reference " << path << std::endl;
+                ++failures;
+                continue;
+            }
+
+            // Per-pixel worst channel difference, summarised
+            size_t badPixels = 0;
+            int maxDiff = 0;
+            double squaredError = 0.0, absoluteError = 0.0;
+            for (size_t i = 0; i < rendered.size(); i += 3)
+            {
+                int pixelDiff = 0;
+                for (size_t c = i; c < i + 3; ++c)
+                {
+                    int diff = std::abs(static_cast<int>(rendered[c]) - static_cast<int>(reference[c]));
+                    pixelDiff = std::max(pixelDiff, diff);
+                    absoluteError += diff;
+                    squaredError += static_cast<double>(diff) * diff;
+                }
+                maxDiff = std::max(maxDiff, pixelDiff);
+                if (pixelDiff > base.goldenTolerance)
+                    ++badPixels;
+            }
+            // A few slightly-off pixels are tolerated, but not a single one
+            // that changed outright, such as light leaking past a wall
+            const double pixelCount = static_cast<double>(rendered.size() / 3);
+            const double mse = squaredError / rendered.size();
+            const double psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+            const bool pass = badPixels <= static_cast<size_t>(std::max(base.goldenMaxBadPixels, 0)) &&
+                              maxDiff <= base.goldenMaxDiff;
+            failures += pass ? 0 : 1;
+
+            std::printf("%s %-16s max %3d  mean %.4f  bad %zu px (%.4f%%)  psnr %.2f dB\n", pass ? "ok  " : "FAIL",
+                        test.name, maxDiff, absoluteError / rendered.size(), badPixels, badPixels / pixelCount * 100.0, psnr);
+        }
+
+        if (!base.goldenRecord)
+            std::cout << (failures ? "golden check failed: " : "golden check passed: ") << failures
+                      << " of " << catalogue().size() << " cases drifted" << std::endl;
+        return failures ? 1 : 0;
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    Settings settings;
+    if (!settings.parse(argc, argv))
+    {
+        return -1;
+    }
+
+    if (!settings.bakeWorldPath.empty())
+    {
+        Scene scene;
+        if (settings.roomCols > 0)
+            scene.generateRooms(settings.roomCols, settings.roomRows);
+        return WorldFileWriter::write(settings.bakeWorldPath, scene.getWalls(), settings.tileSize) ? 0 : -1;
+    }
+
+    if (!settings.goldenDir.empty())
+    {
+        return GoldenSuite::run(settings);
+    }
+
+    Application app(settings);
 
     if (!app.initialize())
     {
@@ -435,4 +1075,4 @@ int main()
     app.run();
 
     return 0;
-}
\ No newline at end of file
+}